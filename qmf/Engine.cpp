@@ -18,15 +18,22 @@
 
 #include <algorithm>
 #include <fstream>
+#include <functional>
+#include <numeric>
 #include <random>
 #include <unordered_map>
 #include <unordered_set>
 
+#include <qmf/utils/Gemm.h>
+#include <qmf/utils/Random.h>
+
 namespace qmf {
 
-void Engine::initAvgTestData(std::vector<size_t>& testUsers,
-                             std::vector<std::vector<Double>>& testLabels,
-                             std::vector<std::vector<Double>>& testScores,
+const size_t Engine::rankBlockSize;
+const size_t Engine::scoreTileUsers;
+const size_t Engine::scoreTileItems;
+
+void Engine::selectTestUsers(std::vector<size_t>& testUsers,
                              const std::vector<DatasetElem>& testDataset,
                              const IdIndex& userIndex,
                              const IdIndex& itemIndex,
@@ -48,6 +55,18 @@ void Engine::initAvgTestData(std::vector<size_t>& testUsers,
     testUsers.erase(testUsers.begin() + numTestUsers, testUsers.end());
     testUsers.shrink_to_fit();
   }
+}
+
+void Engine::initAvgTestData(std::vector<size_t>& testUsers,
+                             std::vector<std::vector<Double>>& testLabels,
+                             std::vector<std::vector<Double>>& testScores,
+                             const std::vector<DatasetElem>& testDataset,
+                             const IdIndex& userIndex,
+                             const IdIndex& itemIndex,
+                             const size_t numTestUsers,
+                             const int32_t seed) {
+  selectTestUsers(
+    testUsers, testDataset, userIndex, itemIndex, numTestUsers, seed);
 
   // map for userIdx -> index in testUsers
   std::unordered_map<size_t, size_t> userMap;
@@ -70,39 +89,309 @@ void Engine::initAvgTestData(std::vector<size_t>& testUsers,
   }
 }
 
+void Engine::initSparseTestData(
+  std::vector<size_t>& testUsers,
+  std::vector<std::vector<size_t>>& testPositives,
+  const std::vector<DatasetElem>& testDataset,
+  const IdIndex& userIndex,
+  const IdIndex& itemIndex,
+  const size_t numTestUsers,
+  const int32_t seed) {
+  selectTestUsers(
+    testUsers, testDataset, userIndex, itemIndex, numTestUsers, seed);
+
+  // map for userIdx -> index in testUsers
+  std::unordered_map<size_t, size_t> userMap;
+  for (size_t i = 0; i < testUsers.size(); ++i) {
+    userMap[testUsers[i]] = i;
+  }
+  testPositives.assign(testUsers.size(), {});
+  for (const auto& elem : testDataset) {
+    const size_t uidx = userIndex.idx(elem.userId);
+    const size_t pidx = itemIndex.idx(elem.itemId);
+    if (uidx == IdIndex::missingIdx || pidx == IdIndex::missingIdx ||
+        userMap.count(uidx) == 0 || elem.value <= 0.0) {
+      continue;
+    }
+    testPositives[userMap[uidx]].push_back(pidx);
+  }
+  for (auto& positives : testPositives) {
+    std::sort(positives.begin(), positives.end());
+    positives.erase(
+      std::unique(positives.begin(), positives.end()), positives.end());
+  }
+}
+
+template <typename ScalarT>
+void Engine::computeTestRanks(
+  std::vector<std::vector<size_t>>& testRanks,
+  const std::vector<size_t>& testUsers,
+  const std::vector<std::vector<size_t>>& testPositives,
+  const BasicFactorData<ScalarT>& userFactors,
+  const BasicFactorData<ScalarT>& itemFactors,
+  ParallelExecutor& parallel) {
+  CHECK_EQ(testUsers.size(), testPositives.size());
+  const size_t nusers = testUsers.size();
+  const size_t nitems = itemFactors.nelems();
+  const size_t nfactors = userFactors.nfactors();
+  auto score = [&](const size_t uidx, const size_t idx) {
+    Double res = itemFactors.withBiases() ? itemFactors.biasAt(idx) : 0.0;
+    for (size_t fidx = 0; fidx < nfactors; ++fidx) {
+      res += static_cast<Double>(userFactors.at(uidx, fidx)) *
+             itemFactors.at(idx, fidx);
+    }
+    return res;
+  };
+
+  // scores of the positives of each user, in decreasing order
+  std::vector<std::vector<Double>> posScores(nusers);
+  parallel.execute(nusers, [&](const size_t taskId) {
+    const auto& positives = testPositives[taskId];
+    auto& scores = posScores[taskId];
+    scores.resize(positives.size());
+    for (size_t j = 0; j < positives.size(); ++j) {
+      scores[j] = score(testUsers[taskId], positives[j]);
+    }
+    std::sort(scores.begin(), scores.end(), std::greater<Double>());
+  });
+
+  // a negative with score x outranks the positives with a score < x, which
+  // are a suffix of posScores: counts[j] is the number of negatives whose
+  // suffix starts at j. with few test users, the blocks of items of each user
+  // are split into ranges that are counted by separate tasks, and the partial
+  // counts of a user are summed below
+  const size_t nblocks = (nitems + rankBlockSize - 1) / rankBlockSize;
+  const size_t nsplits = parallel.numSplits(nusers, nblocks);
+  std::vector<std::vector<size_t>> counts(nusers * nsplits);
+  auto func = [&](const size_t taskId) {
+    const size_t user = taskId / nsplits;
+    const size_t split = taskId % nsplits;
+    const size_t uidx = testUsers[user];
+    const auto& positives = testPositives[user];
+    const auto& scores = posScores[user];
+    const size_t first = split * nblocks / nsplits * rankBlockSize;
+    const size_t last =
+      std::min((split + 1) * nblocks / nsplits * rankBlockSize, nitems);
+
+    auto& partial = counts[taskId];
+    partial.assign(positives.size() + 1, 0);
+    std::vector<Double> blockScores;
+    blockScores.reserve(rankBlockSize);
+    // next positive in item order
+    auto nextPos = std::lower_bound(positives.begin(), positives.end(), first);
+    for (size_t begin = first; begin < last; begin += rankBlockSize) {
+      const size_t end = std::min(begin + rankBlockSize, last);
+      blockScores.clear();
+      for (size_t idx = begin; idx < end; ++idx) {
+        blockScores.push_back(score(uidx, idx));
+      }
+      for (size_t idx = begin; idx < end; ++idx) {
+        if (nextPos != positives.end() && *nextPos == idx) {
+          ++nextPos;
+          continue;
+        }
+        const auto it =
+          std::upper_bound(scores.begin(), scores.end(),
+                           blockScores[idx - begin], std::greater<Double>());
+        ++partial[it - scores.begin()];
+      }
+    }
+  };
+  parallel.execute(nusers * nsplits, func);
+
+  testRanks.resize(nusers);
+  parallel.execute(nusers, [&](const size_t taskId) {
+    auto& ranks = testRanks[taskId];
+    const size_t npos = testPositives[taskId].size();
+    ranks.resize(npos);
+    size_t negAbove = 0;
+    for (size_t j = 0; j < npos; ++j) {
+      for (size_t split = 0; split < nsplits; ++split) {
+        negAbove += counts[taskId * nsplits + split][j];
+      }
+      ranks[j] = negAbove + j;
+    }
+  });
+}
+
+void Engine::sampleTestNegatives(
+  std::vector<std::vector<size_t>>& testNegatives,
+  const std::vector<std::vector<size_t>>& testPositives,
+  const size_t nitems,
+  const size_t nnegatives,
+  const int32_t seed,
+  ParallelExecutor& parallel) {
+  testNegatives.assign(testPositives.size(), {});
+  auto func = [&](const size_t taskId) {
+    const auto& positives = testPositives[taskId];
+    const size_t ncandidates = nitems - positives.size();
+    auto& negatives = testNegatives[taskId];
+    // picks nnegatives distinct candidates with Floyd's algorithm (or all of
+    // them if there are fewer)
+    std::unordered_set<size_t> picked;
+    if (nnegatives < ncandidates) {
+      Xoshiro256 gen(seed, taskId);
+      for (size_t j = ncandidates - nnegatives; j < ncandidates; ++j) {
+        const size_t r = std::uniform_int_distribution<size_t>(0, j)(gen);
+        if (!picked.insert(r).second) {
+          picked.insert(j);
+        }
+      }
+      negatives.assign(picked.begin(), picked.end());
+      std::sort(negatives.begin(), negatives.end());
+    } else {
+      negatives.resize(ncandidates);
+      std::iota(negatives.begin(), negatives.end(), 0);
+    }
+    // the r-th candidate is the r-th item that isn't a positive: as both are
+    // sorted, each one is shifted by the positives at or below it
+    size_t shift = 0;
+    for (auto& idx : negatives) {
+      while (shift < positives.size() && positives[shift] <= idx + shift) {
+        ++shift;
+      }
+      idx += shift;
+    }
+  };
+  parallel.execute(testPositives.size(), func);
+}
+
+template <typename ScalarT>
+void Engine::computeSampledTestRanks(
+  std::vector<std::vector<size_t>>& testRanks,
+  std::vector<size_t>& testNitems,
+  const std::vector<size_t>& testUsers,
+  const std::vector<std::vector<size_t>>& testPositives,
+  const std::vector<std::vector<size_t>>& testNegatives,
+  const BasicFactorData<ScalarT>& userFactors,
+  const BasicFactorData<ScalarT>& itemFactors,
+  ParallelExecutor& parallel) {
+  CHECK_EQ(testUsers.size(), testPositives.size());
+  CHECK_EQ(testUsers.size(), testNegatives.size());
+  testRanks.resize(testUsers.size());
+  testNitems.resize(testUsers.size());
+
+  auto func = [&](const size_t taskId) {
+    const size_t uidx = testUsers[taskId];
+    const size_t nfactors = userFactors.nfactors();
+    auto score = [&](const size_t idx) {
+      Double res = itemFactors.biasAt(idx);
+      for (size_t fidx = 0; fidx < nfactors; ++fidx) {
+        res += static_cast<Double>(userFactors.at(uidx, fidx)) *
+               itemFactors.at(idx, fidx);
+      }
+      return res;
+    };
+
+    // scores of the positives, in decreasing order
+    const auto& positives = testPositives[taskId];
+    const size_t npos = positives.size();
+    std::vector<Double> posScores(npos);
+    for (size_t j = 0; j < npos; ++j) {
+      posScores[j] = score(positives[j]);
+    }
+    std::sort(posScores.begin(), posScores.end(), std::greater<Double>());
+
+    // counted as in computeTestRanks
+    const auto& negatives = testNegatives[taskId];
+    std::vector<size_t> counts(npos + 1);
+    for (const size_t idx : negatives) {
+      const auto it = std::upper_bound(posScores.begin(), posScores.end(),
+                                       score(idx), std::greater<Double>());
+      ++counts[it - posScores.begin()];
+    }
+
+    auto& ranks = testRanks[taskId];
+    ranks.resize(npos);
+    size_t negAbove = 0;
+    for (size_t j = 0; j < npos; ++j) {
+      negAbove += counts[j];
+      ranks[j] = negAbove + j;
+    }
+    testNitems[taskId] = npos + negatives.size();
+  };
+
+  parallel.execute(testUsers.size(), func);
+}
+
+template <typename ScalarT>
 void Engine::computeTestScores(std::vector<std::vector<Double>>& testScores,
                                const std::vector<size_t>& testUsers,
-                               const FactorData& userFactors,
-                               const FactorData& itemFactors,
+                               const BasicFactorData<ScalarT>& userFactors,
+                               const BasicFactorData<ScalarT>& itemFactors,
                                ParallelExecutor& parallel) {
 
-  const size_t ntasks = testUsers.size();
-  auto func =
-    [&testUsers, &testScores, &userFactors, &itemFactors](const size_t taskId) {
-      const size_t uidx = testUsers[taskId];
-      const size_t nfactors = userFactors.nfactors();
-      auto& scores = testScores[taskId];
-      for (size_t idx = 0; idx < itemFactors.nelems(); ++idx) {
-        scores[idx] =
-          itemFactors.withBiases() ? itemFactors.biasAt(idx) : 0.0;
-        for (size_t fidx = 0; fidx < nfactors; ++fidx) {
-          scores[idx] +=
-            userFactors.at(uidx, fidx) * itemFactors.at(idx, fidx);
+  // each task scores a tile of scoreTileUsers users against the items, by
+  // tiles of scoreTileItems items, so that an item tile is read from memory
+  // once for all the users of the tile rather than once per user. with few
+  // test users, the item tiles are also split into ranges scored by separate
+  // tasks
+  const size_t nfactors = userFactors.nfactors();
+  const size_t nitems = itemFactors.nelems();
+  const size_t nuserTiles =
+    (testUsers.size() + scoreTileUsers - 1) / scoreTileUsers;
+  const size_t nitemTiles = (nitems + scoreTileItems - 1) / scoreTileItems;
+  const size_t nsplits = parallel.numSplits(nuserTiles, nitemTiles);
+  const size_t ntasks = nuserTiles * nsplits;
+  auto func = [&](const size_t taskId) {
+    const size_t split = taskId % nsplits;
+    const size_t first = taskId / nsplits * scoreTileUsers;
+    const size_t last = std::min(first + scoreTileUsers, testUsers.size());
+    const size_t nusers = last - first;
+    // the factors of the test users are gathered contiguously
+    std::vector<ScalarT> users(nusers * nfactors);
+    for (size_t i = 0; i < nusers; ++i) {
+      const ScalarT* row = userFactors.row(testUsers[first + i]);
+      std::copy(row, row + nfactors, users.begin() + i * nfactors);
+    }
+    std::vector<Double> tile(nusers * scoreTileItems);
+    for (size_t t = split * nitemTiles / nsplits;
+         t < (split + 1) * nitemTiles / nsplits; ++t) {
+      const size_t begin = t * scoreTileItems;
+      const size_t end = std::min(begin + scoreTileItems, nitems);
+      gemm(nusers, end - begin, nfactors, users.data(), nfactors,
+           itemFactors.row(begin), nfactors, tile.data(), scoreTileItems);
+      for (size_t i = 0; i < nusers; ++i) {
+        const Double* products = tile.data() + i * scoreTileItems;
+        auto& scores = testScores[first + i];
+        for (size_t idx = begin; idx < end; ++idx) {
+          scores[idx] = itemFactors.biasAt(idx) + products[idx - begin];
         }
       }
-    };
+    }
+  };
 
   parallel.execute(ntasks, func);
 }
 
-void Engine::saveFactors(const FactorData& factorData,
+void Engine::evaluateAsync(const size_t nthreads,
+                           std::function<void(ParallelExecutor&)> func) {
+  CHECK_GT(nthreads, 0);
+  waitForEvaluation();
+  if (!evalPool_) {
+    evalParallel_ = std::make_unique<ParallelExecutor>(nthreads);
+    evalPool_ = std::make_unique<ThreadPool>(1);
+  }
+  pendingEval_ = evalPool_->addTask(
+    [this, func]() { func(*evalParallel_); });
+}
+
+void Engine::waitForEvaluation() {
+  if (pendingEval_.valid()) {
+    pendingEval_.get();
+  }
+}
+
+template <typename ScalarT>
+void Engine::saveFactors(const BasicFactorData<ScalarT>& factorData,
                          const IdIndex& index,
                          const std::string& fileName) {
   std::ofstream fout(fileName);
   saveFactors(factorData, index, fout);
 }
 
-void Engine::saveFactors(const FactorData& factorData,
+template <typename ScalarT>
+void Engine::saveFactors(const BasicFactorData<ScalarT>& factorData,
                          const IdIndex& index,
                          std::ostream& out) {
   CHECK_EQ(factorData.nelems(), index.size());
@@ -120,4 +409,64 @@ void Engine::saveFactors(const FactorData& factorData,
     out << '\n';
   }
 }
+
+template void Engine::computeTestScores(
+  std::vector<std::vector<Double>>& testScores,
+  const std::vector<size_t>& testUsers,
+  const FactorData& userFactors,
+  const FactorData& itemFactors,
+  ParallelExecutor& parallel);
+template void Engine::computeTestScores(
+  std::vector<std::vector<Double>>& testScores,
+  const std::vector<size_t>& testUsers,
+  const FloatFactorData& userFactors,
+  const FloatFactorData& itemFactors,
+  ParallelExecutor& parallel);
+
+template void Engine::computeTestRanks(
+  std::vector<std::vector<size_t>>& testRanks,
+  const std::vector<size_t>& testUsers,
+  const std::vector<std::vector<size_t>>& testPositives,
+  const FactorData& userFactors,
+  const FactorData& itemFactors,
+  ParallelExecutor& parallel);
+template void Engine::computeTestRanks(
+  std::vector<std::vector<size_t>>& testRanks,
+  const std::vector<size_t>& testUsers,
+  const std::vector<std::vector<size_t>>& testPositives,
+  const FloatFactorData& userFactors,
+  const FloatFactorData& itemFactors,
+  ParallelExecutor& parallel);
+
+template void Engine::computeSampledTestRanks(
+  std::vector<std::vector<size_t>>& testRanks,
+  std::vector<size_t>& testNitems,
+  const std::vector<size_t>& testUsers,
+  const std::vector<std::vector<size_t>>& testPositives,
+  const std::vector<std::vector<size_t>>& testNegatives,
+  const FactorData& userFactors,
+  const FactorData& itemFactors,
+  ParallelExecutor& parallel);
+template void Engine::computeSampledTestRanks(
+  std::vector<std::vector<size_t>>& testRanks,
+  std::vector<size_t>& testNitems,
+  const std::vector<size_t>& testUsers,
+  const std::vector<std::vector<size_t>>& testPositives,
+  const std::vector<std::vector<size_t>>& testNegatives,
+  const FloatFactorData& userFactors,
+  const FloatFactorData& itemFactors,
+  ParallelExecutor& parallel);
+
+template void Engine::saveFactors(const FactorData& factorData,
+                                  const IdIndex& index,
+                                  const std::string& fileName);
+template void Engine::saveFactors(const FloatFactorData& factorData,
+                                  const IdIndex& index,
+                                  const std::string& fileName);
+template void Engine::saveFactors(const FactorData& factorData,
+                                  const IdIndex& index,
+                                  std::ostream& out);
+template void Engine::saveFactors(const FloatFactorData& factorData,
+                                  const IdIndex& index,
+                                  std::ostream& out);
 }
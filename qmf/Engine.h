@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <functional>
+#include <future>
+#include <memory>
 #include <vector>
 #include <iomanip>
 
@@ -74,24 +77,115 @@ class Engine {
                               const size_t numTestUsers = 0,
                               const int32_t seed = 0);
 
-  // compute predicted scores for all items and all test users
+  // same as initAvgTestData, but only keeps the (sorted) indexes of the
+  // positive items of each test user, for the streaming evaluation
+  static void initSparseTestData(
+    std::vector<size_t>& testUsers,
+    std::vector<std::vector<size_t>>& testPositives,
+    const std::vector<DatasetElem>& testDataset,
+    const IdIndex& userIndex,
+    const IdIndex& itemIndex,
+    const size_t numTestUsers = 0,
+    const int32_t seed = 0);
+
+  // computes the positions of the positives of each test user in the ranking
+  // of all items by decreasing predicted score (see
+  // Metric::computeFromRanks). items are scored by blocks of rankBlockSize,
+  // and each negative is counted against the positives that it outranks, so
+  // that each task only needs O(rankBlockSize + # positives) memory. the
+  // items of a user are split across tasks when there are few test users
+  template <typename ScalarT>
+  static void computeTestRanks(
+    std::vector<std::vector<size_t>>& testRanks,
+    const std::vector<size_t>& testUsers,
+    const std::vector<std::vector<size_t>>& testPositives,
+    const BasicFactorData<ScalarT>& userFactors,
+    const BasicFactorData<ScalarT>& itemFactors,
+    ParallelExecutor& parallel);
+
+  static const size_t rankBlockSize = 4096;
+
+  // samples, for each test user, nnegatives distinct items among the nitems
+  // items that aren't among its (sorted) positives, or all of them if there
+  // are fewer. each user gets its own generator stream of seed, so that the
+  // samples don't depend on the number of threads
+  static void sampleTestNegatives(
+    std::vector<std::vector<size_t>>& testNegatives,
+    const std::vector<std::vector<size_t>>& testPositives,
+    const size_t nitems,
+    const size_t nnegatives,
+    const int32_t seed,
+    ParallelExecutor& parallel);
+
+  // same as computeTestRanks, but only ranks the positives of each user
+  // against its sampled negatives. testNitems gets the number of ranked items
+  // of each user
+  template <typename ScalarT>
+  static void computeSampledTestRanks(
+    std::vector<std::vector<size_t>>& testRanks,
+    std::vector<size_t>& testNitems,
+    const std::vector<size_t>& testUsers,
+    const std::vector<std::vector<size_t>>& testPositives,
+    const std::vector<std::vector<size_t>>& testNegatives,
+    const BasicFactorData<ScalarT>& userFactors,
+    const BasicFactorData<ScalarT>& itemFactors,
+    ParallelExecutor& parallel);
+
+  // compute predicted scores for all items and all test users, with a
+  // blocked product of tiles of test users and tiles of items
+  template <typename ScalarT>
   static void computeTestScores(std::vector<std::vector<Double>>& testScores,
                                 const std::vector<size_t>& testUsers,
-                                const FactorData& userFactors,
-                                const FactorData& itemFactors,
+                                const BasicFactorData<ScalarT>& userFactors,
+                                const BasicFactorData<ScalarT>& itemFactors,
                                 ParallelExecutor& parallel);
 
-  static void saveFactors(const FactorData& factorData,
+  static const size_t scoreTileUsers = 32;
+  static const size_t scoreTileItems = 1024;
+
+  template <typename ScalarT>
+  static void saveFactors(const BasicFactorData<ScalarT>& factorData,
                           const IdIndex& index,
                           const std::string& fileName);
 
-  static void saveFactors(const FactorData& factorData,
+  template <typename ScalarT>
+  static void saveFactors(const BasicFactorData<ScalarT>& factorData,
                           const IdIndex& index,
                           std::ostream& out);
 
+  // runs func in the background once the previous evaluation has completed,
+  // with its own executor of nthreads threads (which run alongside the ones
+  // of the training), so that its tasks don't queue behind the ones of the
+  // next epoch
+  void evaluateAsync(const size_t nthreads,
+                     std::function<void(ParallelExecutor&)> func);
+
+  // waits for the background evaluation, if any
+  void waitForEvaluation();
+
+  // picks the test users, among users of testDataset that are in userIndex
+  static void selectTestUsers(std::vector<size_t>& testUsers,
+                              const std::vector<DatasetElem>& testDataset,
+                              const IdIndex& userIndex,
+                              const IdIndex& itemIndex,
+                              const size_t numTestUsers,
+                              const int32_t seed);
+
   // for unit tests
   FRIEND_TEST(Engine, initAvgTestData);
+  FRIEND_TEST(Engine, initSparseTestData);
+  FRIEND_TEST(Engine, computeTestRanks);
+  FRIEND_TEST(Engine, sampleTestNegatives);
+  FRIEND_TEST(Engine, computeSampledTestRanks);
   FRIEND_TEST(Engine, computeTestScores);
   FRIEND_TEST(Engine, saveFactors);
+  FRIEND_TEST(Engine, evaluateAsync);
+
+ private:
+  // for the asynchronous evaluation (the pool, which runs one evaluation at a
+  // time, is destroyed first, after its pending evaluation)
+  std::unique_ptr<ParallelExecutor> evalParallel_;
+  std::future<void> pendingEval_;
+  std::unique_ptr<ThreadPool> evalPool_;
 };
 }
@@ -23,24 +23,36 @@
 
 namespace qmf {
 
-class FactorData {
+// factors (and optionally biases) of a set of elements, e.g. users or items.
+// factors are stored with elements of type ScalarT, biases in Double.
+template <typename ScalarT>
+class BasicFactorData {
  public:
-  FactorData(const size_t nelems,
-             const size_t nfactors,
-             const bool withBiases = false)
+  BasicFactorData(const size_t nelems,
+                  const size_t nfactors,
+                  const bool withBiases = false)
     : withBiases_(withBiases),
       factors_(nelems, nfactors),
       biases_(withBiases ? nelems : 0) {
   }
 
-  Double at(const size_t idx, const size_t fidx) const {
+  ScalarT at(const size_t idx, const size_t fidx) const {
     return factors_(idx, fidx);
   }
 
-  Double& at(const size_t idx, const size_t fidx) {
+  ScalarT& at(const size_t idx, const size_t fidx) {
     return factors_(idx, fidx);
   }
 
+  // factors of an element, stored contiguously
+  const ScalarT* row(const size_t idx) const {
+    return factors_.data() + idx * nfactors();
+  }
+
+  ScalarT* row(const size_t idx) {
+    return factors_.data() + idx * nfactors();
+  }
+
   Double biasAt(const size_t idx) const {
     return withBiases_ ? biases_(idx) : 0.0;
   }
@@ -78,11 +90,11 @@ class FactorData {
     return withBiases_;
   }
 
-  const Matrix& getFactors() const {
+  const BasicMatrix<ScalarT>& getFactors() const {
     return factors_;
   }
 
-  Matrix& getFactors() {
+  BasicMatrix<ScalarT>& getFactors() {
     return factors_;
   }
 
@@ -94,10 +106,24 @@ class FactorData {
     return biases_;
   }
 
+  // copies the factors and biases of other, which has the same dimensions,
+  // into the memory already allocated by this (e.g. to refresh a snapshot)
+  void copyFrom(const BasicFactorData& other) {
+    CHECK_EQ(nelems(), other.nelems());
+    CHECK_EQ(nfactors(), other.nfactors());
+    CHECK_EQ(withBiases_, other.withBiases_);
+    factors_ = other.factors_;
+    biases_ = other.biases_;
+  }
+
  private:
   const bool withBiases_;
 
-  Matrix factors_;
+  BasicMatrix<ScalarT> factors_;
   Vector biases_;
 };
+
+using FactorData = BasicFactorData<Double>;
+
+using FloatFactorData = BasicFactorData<float>;
 }
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+
+#include <qmf/FactorReader.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+FactorReader::FactorReader(const std::string& fileName)
+  : stream_(std::make_unique<std::ifstream>(fileName)) {
+  CHECK(*stream_) << "can't open " << fileName;
+}
+
+bool FactorReader::readOne(int64_t& id, std::vector<Double>& values) {
+  CHECK(stream_);
+  if (!std::getline(*stream_, line_)) {
+    return false;
+  }
+  const char* str = line_.c_str();
+  char* end;
+  id = std::strtoll(str, &end, 10);
+  CHECK_NE(end, str) << "the file format is incorrect: " << line_;
+  values.clear();
+  while (true) {
+    str = end;
+    const Double value = std::strtod(str, &end);
+    if (end == str) {
+      break;
+    }
+    values.push_back(value);
+  }
+  CHECK(std::all_of(str, line_.c_str() + line_.size(), [](const char c) {
+    return std::isspace(static_cast<unsigned char>(c));
+  })) << "the file format is incorrect: " << line_;
+  return true;
+}
+
+std::unique_ptr<FactorData> FactorReader::readAll(IdIndex& index,
+                                                  size_t nfactors) {
+  std::vector<int64_t> ids;
+  std::vector<Double> data;
+  int64_t id;
+  std::vector<Double> values;
+  size_t nvalues = 0;
+  while (readOne(id, values)) {
+    if (ids.empty()) {
+      nvalues = values.size();
+      if (nfactors == 0) {
+        nfactors = nvalues;
+      }
+      CHECK(nvalues == nfactors || nvalues == nfactors + 1)
+        << "expected " << nfactors << " factors (and an optional bias): "
+        << line_;
+    }
+    CHECK_EQ(values.size(), nvalues) << "the file format is incorrect: "
+                                     << line_;
+    ids.push_back(id);
+    data.insert(data.end(), values.begin(), values.end());
+  }
+
+  const bool withBiases = nvalues == nfactors + 1;
+  auto factors =
+    std::make_unique<FactorData>(ids.size(), nfactors, withBiases);
+  for (size_t idx = 0; idx < ids.size(); ++idx) {
+    CHECK_EQ(index.getOrSetIdx(ids[idx]), idx)
+      << "duplicate or already indexed id " << ids[idx];
+    const Double* row = data.data() + idx * nvalues;
+    if (withBiases) {
+      factors->biasAt(idx) = *row++;
+    }
+    std::copy(row, row + nfactors, factors->row(idx));
+  }
+  return factors;
+}
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <qmf/FactorData.h>
+#include <qmf/utils/IdIndex.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+// reads factors in the format written by Engine::saveFactors, i.e. one line
+// per element with its id, optionally its bias, then its factors
+class FactorReader {
+ public:
+  // for unit tests
+  FactorReader() = default;
+
+  explicit FactorReader(const std::string& fileName);
+
+  // reads the entire file: ids are added to index in order, and all the lines
+  // need to have nfactors values, or nfactors + 1 values if they start with a
+  // bias (nfactors = 0 takes the number of values of the first line, without
+  // bias)
+  std::unique_ptr<FactorData> readAll(IdIndex& index,
+                                      const size_t nfactors = 0);
+
+ private:
+  // reads one line, returns false at the end of the file
+  bool readOne(int64_t& id, std::vector<Double>& values);
+
+  std::unique_ptr<std::istream> stream_;
+
+  std::string line_;
+
+  // for unit tests
+  FRIEND_TEST(FactorReader, readAll);
+  FRIEND_TEST(FactorReader, readAllWithBiases);
+  FRIEND_TEST(FactorReader, readAllBadFormat);
+};
+}
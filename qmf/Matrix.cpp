@@ -33,31 +33,45 @@ extern "C" void dsysv_(char* uplo,
                        double* work,
                        int* lwork,
                        int* info);
+
+extern "C" void dsyev_(char* jobz,
+                       char* uplo,
+                       int* n,
+                       double* a,
+                       int* lda,
+                       double* w,
+                       double* work,
+                       int* lwork,
+                       int* info);
 }
 
 
-Matrix::Matrix(const size_t nrows, const size_t ncols)
+template <typename ScalarT>
+BasicMatrix<ScalarT>::BasicMatrix(const size_t nrows, const size_t ncols)
   : nrows_(nrows),
     ncols_(ncols),
     data_(nrows * ncols, 0.0) {
   CHECK_GT(nrows * ncols, 0) << "matrix's dimensions should be positive";
 }
 
-Matrix::Matrix(Matrix&& X) {
+template <typename ScalarT>
+BasicMatrix<ScalarT>::BasicMatrix(BasicMatrix&& X) {
   nrows_ = X.nrows_;
   ncols_ = X.ncols_;
   data_ = std::move(X.data_);
 }
 
-Matrix& Matrix::operator=(Matrix&& X) {
+template <typename ScalarT>
+BasicMatrix<ScalarT>& BasicMatrix<ScalarT>::operator=(BasicMatrix&& X) {
   nrows_ = X.nrows_;
   ncols_ = X.ncols_;
   data_ = std::move(X.data_);
   return *this;
 }
 
-Matrix Matrix::transpose() const {
-  Matrix T(ncols_, nrows_);
+template <typename ScalarT>
+BasicMatrix<ScalarT> BasicMatrix<ScalarT>::transpose() const {
+  BasicMatrix T(ncols_, nrows_);
   for (size_t i = 0; i < nrows_; ++i) {
     for (size_t j = 0; j < ncols_; ++j) {
       T(j, i) = operator()(i, j);
@@ -66,10 +80,12 @@ Matrix Matrix::transpose() const {
   return T;
 }
 
-Matrix Matrix::operator+(const Matrix& X) const {
+template <typename ScalarT>
+BasicMatrix<ScalarT> BasicMatrix<ScalarT>::operator+(
+  const BasicMatrix& X) const {
   CHECK_EQ(nrows_, X.nrows());
   CHECK_EQ(ncols_, X.ncols());
-  Matrix S(nrows_, ncols_);
+  BasicMatrix S(nrows_, ncols_);
   for (size_t i = 0; i < nrows_; ++i) {
     for (size_t j = 0; j < ncols_; ++j) {
       S(i, j) = operator()(i, j) + X(i, j);
@@ -78,6 +94,9 @@ Matrix Matrix::operator+(const Matrix& X) const {
   return S;
 }
 
+template class BasicMatrix<Double>;
+template class BasicMatrix<float>;
+
 Vector linearSymmetricSolve(Matrix A, Vector b) {
   CHECK_EQ(A.nrows(), A.ncols()) << "A should be squared";
   CHECK_EQ(A.nrows(), b.size()) << "b should have the same number of rows as A";
@@ -94,4 +113,28 @@ Vector linearSymmetricSolve(Matrix A, Vector b) {
   CHECK_EQ(result, 0) << "dgesv failed, code " << result;
   return b;
 }
+
+void symmetricEigen(const Matrix& A, Vector& w, Matrix& Q) {
+  CHECK_EQ(A.nrows(), A.ncols()) << "A should be squared";
+  CHECK_EQ(A.nrows(), w.size()) << "w should have the same number of rows as A";
+  int n = static_cast<int>(A.nrows());
+  // A is symmetric, so its columnar order is the same
+  Matrix V = A;
+  const char* jobz = "Vectors";
+  const char* uplo = "Upper";
+  int result = 0;
+  // query the optimal workspace size first
+  int lwork = -1;
+  Double workSize = 0.0;
+  detail::dsyev_(const_cast<char*>(jobz), const_cast<char*>(uplo), &n,
+                 V.data(), &n, w.data(), &workSize, &lwork, &result);
+  CHECK_EQ(result, 0) << "dsyev failed, code " << result;
+  lwork = static_cast<int>(workSize);
+  std::vector<Double> work(lwork);
+  detail::dsyev_(const_cast<char*>(jobz), const_cast<char*>(uplo), &n,
+                 V.data(), &n, w.data(), &work[0], &lwork, &result);
+  CHECK_EQ(result, 0) << "dsyev failed, code " << result;
+  // eigenvectors are stored in columnar order
+  Q = V.transpose();
+}
 }
@@ -23,24 +23,25 @@
 
 namespace qmf {
 
-// class for a row-wise matrix
-class Matrix {
+// class for a row-wise matrix, with elements of type ScalarT
+template <typename ScalarT>
+class BasicMatrix {
  public:
-  Matrix(const size_t nrows, const size_t ncols);
+  BasicMatrix(const size_t nrows, const size_t ncols);
 
   // default copy
-  Matrix(const Matrix& X) = default;
-  Matrix& operator=(const Matrix& X) = default;
+  BasicMatrix(const BasicMatrix& X) = default;
+  BasicMatrix& operator=(const BasicMatrix& X) = default;
 
   // move semantics
-  Matrix(Matrix&& X);
-  Matrix& operator=(Matrix&& X);
+  BasicMatrix(BasicMatrix&& X);
+  BasicMatrix& operator=(BasicMatrix&& X);
 
-  Double operator()(const size_t r, const size_t c) const {
+  ScalarT operator()(const size_t r, const size_t c) const {
     return data_[index(r, c)];
   }
 
-  Double& operator()(const size_t r, const size_t c) {
+  ScalarT& operator()(const size_t r, const size_t c) {
     return data_[index(r, c)];
   }
 
@@ -53,12 +54,16 @@ class Matrix {
   }
 
   // computes matrix transpose, X^T
-  Matrix transpose() const;
+  BasicMatrix transpose() const;
 
-  Matrix operator+(const Matrix& X) const;
+  BasicMatrix operator+(const BasicMatrix& X) const;
 
   // returns a raw pointer to the data
-  Double* const data() {
+  ScalarT* const data() {
+    return &data_[0];
+  }
+
+  const ScalarT* data() const {
     return &data_[0];
   }
 
@@ -71,11 +76,20 @@ class Matrix {
 
   size_t ncols_;
 
-  std::vector<Double> data_;
+  std::vector<ScalarT> data_;
 };
 
+using Matrix = BasicMatrix<Double>;
+
+// single precision matrix, e.g. for halving the memory used by factors
+using FloatMatrix = BasicMatrix<float>;
+
 // solves a system of linear equations, A * x = b.
 // matrix A should symmetric and vector b should have the same number of rows as A.
 Vector linearSymmetricSolve(Matrix A, Vector b);
 
+// computes the eigendecomposition of a symmetric matrix, A = Q * diag(w) * Q^T.
+// eigenvalues are returned in ascending order, eigenvectors are the columns of Q.
+void symmetricEigen(const Matrix& A, Vector& w, Matrix& Q);
+
 }
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <qmf/Recommender.h>
+
+#include <algorithm>
+
+#include <qmf/utils/Gemm.h>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+const size_t Recommender::tileUsers;
+const size_t Recommender::tileItems;
+
+Recommender::Recommender(const FactorData& userFactors,
+                         const FactorData& itemFactors,
+                         const ItemSets& seen,
+                         const size_t k)
+  : userFactors_(userFactors),
+    itemFactors_(itemFactors),
+    seen_(seen),
+    k_(k) {
+  CHECK_EQ(userFactors_.nfactors(), itemFactors_.nfactors());
+  CHECK(seen_.nusers() == 0 || seen_.nusers() == userFactors_.nelems())
+    << "seen items should be given for all users";
+  CHECK_GT(k_, 0);
+}
+
+void Recommender::push(std::vector<Recommendation>& heap,
+                       const Recommendation& candidate) const {
+  if (heap.size() < k_) {
+    heap.push_back(candidate);
+    std::push_heap(heap.begin(), heap.end(), better);
+  } else if (better(candidate, heap.front())) {
+    std::pop_heap(heap.begin(), heap.end(), better);
+    heap.back() = candidate;
+    std::push_heap(heap.begin(), heap.end(), better);
+  }
+}
+
+std::vector<std::vector<Recommendation>> Recommender::recommend(
+  const std::vector<size_t>& users,
+  ParallelExecutor& parallel) const {
+  const size_t nfactors = userFactors_.nfactors();
+  const size_t nitems = itemFactors_.nelems();
+  const size_t nuserTiles = (users.size() + tileUsers - 1) / tileUsers;
+  const size_t nitemTiles = (nitems + tileItems - 1) / tileItems;
+  const size_t nsplits = parallel.numSplits(nuserTiles, nitemTiles);
+
+  // heaps[u * nsplits + split] are the best items of users[u] in the split
+  std::vector<std::vector<Recommendation>> heaps(users.size() * nsplits);
+  auto func = [&](const size_t taskId) {
+    const size_t split = taskId % nsplits;
+    const size_t first = taskId / nsplits * tileUsers;
+    const size_t last = std::min(first + tileUsers, users.size());
+    const size_t nusers = last - first;
+    const size_t firstTile = split * nitemTiles / nsplits;
+    const size_t lastTile = (split + 1) * nitemTiles / nsplits;
+
+    // the factors of the users are gathered contiguously
+    std::vector<Double> userRows(nusers * nfactors);
+    // next seen item of each user
+    std::vector<const uint32_t*> seenItems(nusers);
+    for (size_t i = 0; i < nusers; ++i) {
+      const size_t uidx = users[first + i];
+      const Double* row = userFactors_.row(uidx);
+      std::copy(row, row + nfactors, userRows.begin() + i * nfactors);
+      if (seen_.nusers() > 0) {
+        seenItems[i] = std::lower_bound(
+          seen_.begin(uidx), seen_.end(uidx), firstTile * tileItems);
+      }
+    }
+
+    std::vector<Double> tile(nusers * tileItems);
+    for (size_t t = firstTile; t < lastTile; ++t) {
+      const size_t begin = t * tileItems;
+      const size_t end = std::min(begin + tileItems, nitems);
+      gemm(nusers, end - begin, nfactors, userRows.data(), nfactors,
+           itemFactors_.row(begin), nfactors, tile.data(), tileItems);
+      for (size_t i = 0; i < nusers; ++i) {
+        const size_t uidx = users[first + i];
+        const Double* products = tile.data() + i * tileItems;
+        auto& heap = heaps[(first + i) * nsplits + split];
+        auto& next = seenItems[i];
+        for (size_t idx = begin; idx < end; ++idx) {
+          if (seen_.nusers() > 0 && next != seen_.end(uidx) && *next == idx) {
+            ++next;
+            continue;
+          }
+          push(heap, {idx, itemFactors_.biasAt(idx) + products[idx - begin]});
+        }
+      }
+    }
+  };
+  parallel.execute(nuserTiles * nsplits, func);
+
+  std::vector<std::vector<Recommendation>> res(users.size());
+  parallel.execute(users.size(), [&](const size_t u) {
+    auto& heap = heaps[u * nsplits];
+    for (size_t split = 1; split < nsplits; ++split) {
+      for (const auto& candidate : heaps[u * nsplits + split]) {
+        push(heap, candidate);
+      }
+    }
+    std::sort_heap(heap.begin(), heap.end(), better);
+    res[u] = std::move(heap);
+  });
+  return res;
+}
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <qmf/FactorData.h>
+#include <qmf/Types.h>
+#include <qmf/utils/ItemSets.h>
+#include <qmf/utils/ParallelExecutor.h>
+
+namespace qmf {
+
+struct Recommendation {
+  size_t itemIdx;
+  Double score;
+};
+
+// computes the top k items of users, by decreasing predicted score, without
+// the items that each user has already seen
+class Recommender {
+ public:
+  // seen has the sets of the users of userFactors, or no set at all to not
+  // exclude anything
+  Recommender(const FactorData& userFactors,
+              const FactorData& itemFactors,
+              const ItemSets& seen,
+              const size_t k);
+
+  // returns the recommendations of each of users (indexes in userFactors),
+  // best first. tiles of tileUsers users are scored against tiles of
+  // tileItems items with a blocked product, and each task keeps a heap of
+  // the best items of each of its users. with few users, the items are also
+  // split across tasks, whose heaps are merged at the end
+  std::vector<std::vector<Recommendation>> recommend(
+    const std::vector<size_t>& users,
+    ParallelExecutor& parallel) const;
+
+  static const size_t tileUsers = 32;
+  static const size_t tileItems = 1024;
+
+ private:
+  // higher scores first, then lower item indexes
+  static bool better(const Recommendation& a, const Recommendation& b) {
+    return a.score > b.score || (a.score == b.score && a.itemIdx < b.itemIdx);
+  }
+
+  // keeps the k best candidates in heap, whose front is the worst of them
+  void push(std::vector<Recommendation>& heap,
+            const Recommendation& candidate) const;
+
+  const FactorData& userFactors_;
+  const FactorData& itemFactors_;
+  const ItemSets& seen_;
+  const size_t k_;
+};
+}
@@ -16,10 +16,21 @@
 
 #include <qmf/Vector.h>
 
+#include <glog/logging.h>
+
 namespace qmf {
 
 Vector::Vector(const size_t n)
   : data_(n) {
 }
 
+Vector Vector::operator+(const Vector& v) const {
+  CHECK_EQ(size(), v.size());
+  Vector s(size());
+  for (size_t i = 0; i < size(); ++i) {
+    s(i) = data_[i] + v(i);
+  }
+  return s;
+}
+
 }
@@ -38,6 +38,8 @@ class Vector {
     return data_.size();
   }
 
+  Vector operator+(const Vector& v) const;
+
   Double* const data() {
     return data_.data();
   }
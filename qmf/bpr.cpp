@@ -37,10 +37,37 @@ DEFINE_double(init_distribution_bound, 0.01, "init distirbution bound");
 DEFINE_uint64(num_negative_samples, 3, "number of negative items to sample for each positive item");
 DEFINE_uint64(num_hogwild_threads, 1, "number of parallel threads for hogwild");
 DEFINE_bool(shuffle_training_set, true, "shuffle training set after each epoch");
+DEFINE_int64(seed, -1, "random seed for training (-1 = random seed)");
+DEFINE_uint64(batch_size, 1, "number of triplets whose gradients are "
+                             "computed together before updating");
+DEFINE_uint64(num_strata, 0, "if > 1, train on a grid of num_strata x "
+                             "num_strata user/item blocks, without "
+                             "conflicting updates (instead of hogwild)");
+DEFINE_string(negative_sampler, "uniform", "distribution of negatives: "
+                                           "uniform, popularity, adaptive or "
+                                           "in_batch");
+DEFINE_uint64(in_batch_pool_size, 64, "number of items sampled for the "
+                                      "shared pool of the in_batch sampler");
+DEFINE_double(popularity_exponent, 0.75, "exponent of the item popularity "
+                                         "for the popularity sampler");
+DEFINE_bool(user_major, false, "process all the triplets of a user "
+                              "consecutively, in random order");
+DEFINE_double(adaptive_rank_scale, 0.05, "mean rank of the adaptive sampler, "
+                                         "as a fraction of the # of items");
+DEFINE_uint64(num_hot_items, 0, "number of most popular items that each "
+                                "hogwild thread updates in its own copy");
+DEFINE_uint64(hot_item_sync_interval, 10000, "number of triplets between "
+                                             "merges of the hot item copies");
+DEFINE_string(optimizer, "sgd", "step size rule: sgd, adagrad or adam");
+DEFINE_double(adam_beta1, 0.9, "decay rate of the first moment for adam");
+DEFINE_double(adam_beta2, 0.999, "decay rate of the second moment for adam");
+DEFINE_double(optimizer_epsilon, 1e-8, "added to the denominator of the "
+                                       "adagrad and adam steps");
 
 // settings
 DEFINE_uint64(eval_num_neg, 3, "number of negatives generated per positive in evaluation");
 DEFINE_int32(eval_seed, 42, "random seed for generating evaluation set and test users");
+DEFINE_uint64(eval_max_triplets, 0, "maximum size of the evaluation sets (0 = no limit)");
 DEFINE_uint64(nthreads, 16, "number of threads for parallel execution");
 
 // datasets
@@ -53,6 +80,15 @@ DEFINE_uint64(num_test_users, 0, "# users to use for computing test avg metrics
 DEFINE_bool(test_always, false, "whether to compute test avg metrics after "
                                 "each epoch (if false, only computes at the "
                                 "end)");
+DEFINE_bool(streaming_eval, false, "compute test avg metrics by scoring items "
+                                  "by blocks, without dense per-user vectors");
+DEFINE_uint64(eval_sampled_negatives, 0, "rank the positives of each test user "
+              "against this many sampled items instead of all items, for "
+              "test avg metrics recorded as test_sampled_avg_* (0 = disabled)");
+DEFINE_bool(async_eval, false, "compute test avg metrics on a snapshot of the "
+                               "factors in the background, during the next epoch");
+DEFINE_uint64(eval_nthreads, 1, "number of threads of the background "
+              "evaluation with --async_eval, in addition to --nthreads");
 
 // model output
 DEFINE_string(user_factors, "", "filename of user factors");
@@ -70,6 +106,27 @@ int main(int argc, char** argv) {
       << "warning: missing model output filenames! (use options --{user,item}_factors)";
   }
 
+  qmf::NegativeSampler negativeSampler = qmf::NegativeSampler::Uniform;
+  if (FLAGS_negative_sampler == "popularity") {
+    negativeSampler = qmf::NegativeSampler::Popularity;
+  } else if (FLAGS_negative_sampler == "adaptive") {
+    negativeSampler = qmf::NegativeSampler::Adaptive;
+  } else if (FLAGS_negative_sampler == "in_batch") {
+    negativeSampler = qmf::NegativeSampler::InBatch;
+  } else {
+    CHECK_EQ(FLAGS_negative_sampler, "uniform")
+      << "unknown negative sampler " << FLAGS_negative_sampler;
+  }
+
+  qmf::Optimizer optimizer = qmf::Optimizer::SGD;
+  if (FLAGS_optimizer == "adagrad") {
+    optimizer = qmf::Optimizer::Adagrad;
+  } else if (FLAGS_optimizer == "adam") {
+    optimizer = qmf::Optimizer::Adam;
+  } else {
+    CHECK_EQ(FLAGS_optimizer, "sgd") << "unknown optimizer " << FLAGS_optimizer;
+  }
+
   qmf::BPRConfig config{FLAGS_nepochs,
                         FLAGS_nfactors,
                         FLAGS_init_learning_rate,
@@ -81,10 +138,27 @@ int main(int argc, char** argv) {
                         FLAGS_init_distribution_bound,
                         FLAGS_num_negative_samples,
                         FLAGS_num_hogwild_threads,
-                        FLAGS_shuffle_training_set};
+                        FLAGS_shuffle_training_set,
+                        FLAGS_seed,
+                        FLAGS_batch_size,
+                        FLAGS_num_strata,
+                        negativeSampler,
+                        FLAGS_popularity_exponent,
+                        FLAGS_adaptive_rank_scale,
+                        FLAGS_in_batch_pool_size,
+                        FLAGS_user_major,
+                        FLAGS_num_hot_items,
+                        FLAGS_hot_item_sync_interval,
+                        optimizer,
+                        FLAGS_adam_beta1,
+                        FLAGS_adam_beta2,
+                        FLAGS_optimizer_epsilon,
+                        FLAGS_eval_max_triplets};
 
   qmf::MetricsConfig metricsConfig{
-    FLAGS_num_test_users, FLAGS_test_always, FLAGS_eval_seed};
+    FLAGS_num_test_users, FLAGS_test_always, FLAGS_eval_seed,
+    FLAGS_streaming_eval, FLAGS_eval_sampled_negatives, FLAGS_async_eval,
+    FLAGS_eval_nthreads};
   const auto metricsEngine =
     std::make_unique<qmf::MetricsEngine>(metricsConfig);
 
@@ -92,8 +166,9 @@ int main(int argc, char** argv) {
   const auto metrics = qmf::split(FLAGS_test_avg_metrics, ',');
   if (!metrics.empty()) {
     for (const auto& metric : metrics) {
-      CHECK(metricsEngine->addTestAvgMetric(metric)) << "metric " << metric
-                                                     << " is not available";
+      CHECK(metricsEngine->addTestAvgMetric(metric))
+        << "metric " << metric << " is not available (with --streaming_eval "
+        << "or --eval_sampled_negatives, only metrics computed from ranks are)";
     }
   }
 
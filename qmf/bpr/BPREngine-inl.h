@@ -16,15 +16,55 @@
 
 namespace qmf {
 
-template <typename FuncT, typename GenT>
-void BPREngine::iterate(FuncT func, const size_t numNeg, GenT&& gen) const {
-  for (const auto& elem : data_) {
-    for (size_t i = 0; i < numNeg; ++i) {
-      func(PosNegTriplet{
-        elem.userIdx,
-        elem.posItemIdx,
-        sampleRandomNegative(elem.userIdx, std::forward<GenT>(gen))});
+template <typename PositiveT>
+void BPREngine::sampleEvalSet(std::vector<PosNegTriplet>& evalSet,
+                              const size_t npositives,
+                              PositiveT positive,
+                              const bool useTestItemSets) {
+  evalSet.clear();
+  if (npositives == 0 || evalNumNeg_ == 0) {
+    return;
+  }
+  size_t nsampled = npositives;
+  if (config_.evalMaxTriplets > 0) {
+    nsampled = std::min(
+      nsampled, std::max<size_t>(config_.evalMaxTriplets / evalNumNeg_, 1));
+  }
+  // stratum s takes its share of the sampled positives, in order, from its
+  // share of all positives
+  const size_t nstrata = std::min(npositives, evalStrata);
+  std::vector<std::vector<PosNegTriplet>> strata(nstrata);
+  auto sampleStratum = [&, nstrata, nsampled](const size_t stratum) {
+    const size_t first = stratum * npositives / nstrata;
+    const size_t last = (stratum + 1) * npositives / nstrata;
+    const size_t quota = std::min(last - first,
+                                  (stratum + 1) * nsampled / nstrata -
+                                    stratum * nsampled / nstrata);
+    auto& out = strata[stratum];
+    out.reserve(quota * evalNumNeg_);
+    Xoshiro256 gen(evalSeed_, stratum);
+    std::uniform_real_distribution<Double> distr(0.0, 1.0);
+    size_t nkept = 0;
+    for (size_t k = first; k < last && nkept < quota; ++k) {
+      // selection sampling: keep each positive with probability
+      // (# left to keep) / (# left to visit)
+      if ((last - k) * distr(gen) >= quota - nkept) {
+        continue;
+      }
+      const auto p = positive(k);
+      for (size_t j = 0; j < evalNumNeg_; ++j) {
+        out.push_back(PosNegTriplet{
+          p.first,
+          p.second,
+          sampleRandomNegative(p.first, gen, useTestItemSets)});
+      }
+      ++nkept;
     }
+  };
+  parallel_.execute(nstrata, sampleStratum);
+  evalSet.reserve(nsampled * evalNumNeg_);
+  for (const auto& out : strata) {
+    evalSet.insert(evalSet.end(), out.begin(), out.end());
   }
 }
 
@@ -40,22 +80,283 @@ void BPREngine::iterateBlock(FuncT func,
       func(PosNegTriplet{
         elem.userIdx,
         elem.posItemIdx,
-        sampleRandomNegative(elem.userIdx, std::forward<GenT>(gen))});
+        sampleNegative(elem.userIdx, gen)});
+    }
+  }
+}
+
+template <typename IterateT>
+void BPREngine::runTriplets(IterateT iterate, HotItemCache* cache) {
+  auto countUpdates = [this, cache](const size_t ntriplets) {
+    if (cache) {
+      cache->sinceSync += ntriplets;
+      if (cache->sinceSync >= config_.hotItemSyncInterval) {
+        syncHotItems(*cache);
+      }
+    }
+  };
+  if (config_.batchSize <= 1) {
+    iterate([this, cache, &countUpdates](const PosNegTriplet& triplet) {
+      update(triplet, cache);
+      countUpdates(1);
+    });
+    return;
+  }
+  std::vector<PosNegTriplet> batch;
+  batch.reserve(config_.batchSize);
+  std::vector<Double> grads(config_.batchSize);
+  auto addToBatch = [this, cache, &countUpdates, &batch, &grads](
+    const PosNegTriplet& triplet) {
+    batch.push_back(triplet);
+    if (batch.size() == config_.batchSize) {
+      updateBatch(batch, grads, cache);
+      countUpdates(batch.size());
+      batch.clear();
+    }
+  };
+  iterate(addToBatch);
+  updateBatch(batch, grads, cache);
+}
+
+template <typename GenT>
+void BPREngine::runBlocks(const size_t first,
+                          const size_t last,
+                          GenT&& gen,
+                          HotItemCache* cache) {
+  if (config_.negativeSampler == NegativeSampler::InBatch) {
+    std::vector<PosPair> batch;
+    batch.reserve(config_.batchSize);
+    for (size_t i = first; i < last; ++i) {
+      const size_t block = blockOrder_[i];
+      for (size_t k = blockStart(block); k < blockStart(block + 1); ++k) {
+        batch.push_back(data_[k]);
+        if (batch.size() == config_.batchSize) {
+          updateInBatch(batch, gen);
+          batch.clear();
+        }
+      }
+      checkGradients();
+    }
+    updateInBatch(batch, gen);
+    checkGradients();
+    return;
+  }
+  if (cache) {
+    // load the current values of the hot items
+    syncHotItems(*cache);
+  }
+  runTriplets([this, first, last, &gen](auto&& func) {
+    for (size_t i = first; i < last; ++i) {
+      const size_t block = blockOrder_[i];
+      iterateBlock(func, blockStart(block), blockStart(block + 1),
+                   config_.numNegativeSamples, gen);
+      checkGradients();
+    }
+  }, cache);
+  checkGradients();
+  if (cache) {
+    syncHotItems(*cache);
+  }
+}
+
+template <typename GenT>
+size_t BPREngine::sampleNegative(const size_t userIdx, GenT&& gen) const {
+  // the in-batch sampler only applies to batches, see updateInBatch
+  if (config_.negativeSampler == NegativeSampler::Uniform ||
+      config_.negativeSampler == NegativeSampler::InBatch) {
+    return sampleRandomNegative(userIdx, gen);
+  }
+  for (size_t i = 0; i < maxNegativeTries; ++i) {
+    const size_t negIdx =
+      config_.negativeSampler == NegativeSampler::Popularity ?
+        popularityTable_->sample(gen) :
+        sampleAdaptiveNegative(userIdx, gen);
+    if (!itemSets_.contains(userIdx, negIdx)) {
+      return negIdx;
+    }
+  }
+  return sampleRandomNegative(userIdx, gen);
+}
+
+template <typename GenT>
+size_t BPREngine::sampleAdaptiveNegative(const size_t userIdx,
+                                         GenT&& gen) const {
+  const size_t n = nitems();
+  // rank r with probability proportional to exp(-r / lambda)
+  const Double lambda = std::max(config_.adaptiveRankScale * n, 1.0);
+  std::geometric_distribution<size_t> rankDistr(1.0 - std::exp(-1.0 / lambda));
+  size_t rank;
+  do {
+    rank = rankDistr(gen);
+  } while (rank >= n);
+
+  // factor f with probability proportional to |p_uf| * stddev_f
+  const Double* pu = userFactors_->row(userIdx);
+  Double sum = 0.0;
+  for (size_t f = 0; f < config_.nfactors; ++f) {
+    sum += std::abs(pu[f]) * factorStddevs_[f];
+  }
+  if (!(sum > 0.0)) {
+    return sampleRandomNegative(userIdx, gen);
+  }
+  std::uniform_real_distribution<Double> distr(0.0, sum);
+  Double x = distr(gen);
+  size_t f = 0;
+  while (f + 1 < config_.nfactors) {
+    x -= std::abs(pu[f]) * factorStddevs_[f];
+    if (x < 0.0) {
+      break;
     }
+    ++f;
   }
+
+  // top items of the factor have the highest scores if p_uf > 0, the bottom
+  // ones otherwise
+  const uint32_t* ranking = factorRankings_.data() + f * n;
+  return pu[f] > 0.0 ? ranking[rank] : ranking[n - 1 - rank];
 }
 
 template <typename GenT>
 size_t BPREngine::sampleRandomNegative(const size_t userIdx,
                                        GenT&& gen,
-                                       const bool useTestItemMap) const {
-  const auto& userPosSet =
-    useTestItemMap ? testItemMap_.at(userIdx) : itemMap_.at(userIdx);
+                                       const bool useTestItemSets) const {
+  const auto& posSets = useTestItemSets ? testItemSets_ : itemSets_;
   std::uniform_int_distribution<> dis(0, static_cast<int>(nitems()) - 1);
   size_t negIdx;
   do {
     negIdx = dis(gen);
-  } while (userPosSet.count(negIdx) > 0);
+  } while (posSets.contains(userIdx, negIdx));
   return negIdx;
 }
+
+template <typename GenT>
+size_t BPREngine::sampleRandomNegativeInRange(const size_t userIdx,
+                                              const size_t itemBegin,
+                                              const size_t itemEnd,
+                                              GenT&& gen) const {
+  // count the positives in the range, to avoid sampling forever
+  const uint32_t* first = itemSets_.begin(userIdx);
+  const uint32_t* last = itemSets_.end(userIdx);
+  const size_t numPos = std::lower_bound(first, last, itemEnd) -
+                        std::lower_bound(first, last, itemBegin);
+  if (numPos >= itemEnd - itemBegin) {
+    return IdIndex::missingIdx;
+  }
+  std::uniform_int_distribution<size_t> dis(itemBegin, itemEnd - 1);
+  size_t negIdx;
+  do {
+    negIdx = dis(gen);
+  } while (itemSets_.contains(userIdx, negIdx));
+  return negIdx;
+}
+
+template <typename FuncT>
+void BPREngine::withKernel(FuncT func) const {
+  auto withOptimizer = [this, &func](auto nfactors) {
+    switch (config_.optimizer) {
+      case Optimizer::SGD:
+        func(nfactors, std::integral_constant<Optimizer, Optimizer::SGD>());
+        break;
+      case Optimizer::Adagrad:
+        func(nfactors,
+             std::integral_constant<Optimizer, Optimizer::Adagrad>());
+        break;
+      case Optimizer::Adam:
+        func(nfactors, std::integral_constant<Optimizer, Optimizer::Adam>());
+        break;
+    }
+  };
+  switch (config_.nfactors) {
+    case 8:
+      withOptimizer(std::integral_constant<size_t, 8>());
+      break;
+    case 16:
+      withOptimizer(std::integral_constant<size_t, 16>());
+      break;
+    case 32:
+      withOptimizer(std::integral_constant<size_t, 32>());
+      break;
+    case 64:
+      withOptimizer(std::integral_constant<size_t, 64>());
+      break;
+    case 128:
+      withOptimizer(std::integral_constant<size_t, 128>());
+      break;
+    default:
+      withOptimizer(std::integral_constant<size_t, 0>());
+  }
+}
+
+template <Optimizer O>
+Double BPREngine::step(const StepParams& params,
+                       const Double g,
+                       float* state,
+                       const size_t k,
+                       const size_t n) {
+  if (O == Optimizer::Adagrad) {
+    // G <- G + g^2, x <- x + lr * g / (sqrt(G) + eps)
+    state[k] += g * g;
+    return params.lr * g / (std::sqrt(state[k]) + params.epsilon);
+  }
+  if (O == Optimizer::Adam) {
+    // m <- b1 * m + (1 - b1) * g, v <- b2 * v + (1 - b2) * g^2,
+    // x <- x + lr * m / (sqrt(v) + eps)
+    float& m = state[k];
+    float& v = state[n + 1 + k];
+    m = params.beta1 * m + (1.0 - params.beta1) * g;
+    v = params.beta2 * v + (1.0 - params.beta2) * g * g;
+    return params.lr * m / (std::sqrt(v) + params.epsilon);
+  }
+  return params.lr * g;
+}
+
+template <size_t N, Optimizer O>
+void BPREngine::applyUpdate(const TripletRows& rows, const Double e) {
+  const size_t n = N > 0 ? N : config_.nfactors;
+  const StepParams params = stepParams();
+  const Double userLambda = config_.userLambda;
+  const Double itemLambda = config_.itemLambda;
+  Double* pu = rows.pu;
+  Double* qi = rows.qi;
+  Double* qj = rows.qj;
+
+  // update biases
+  if (rows.bi) {
+    Double& bi = *rows.bi;
+    Double& bj = *rows.bj;
+    // b_i <- b_i + lr * (e - b_lambda * b_i)
+    bi += step<O>(params, e - config_.biasLambda * bi, rows.si, n, n);
+    // b_j <- b_j + lr * (-e - b_lambda * b_j)
+    bj += step<O>(params, -e - config_.biasLambda * bj, rows.sj, n, n);
+  }
+
+  // update all the factors in a single pass
+  for (size_t i = 0; i < n; ++i) {
+    // p_u <- p_u + lr * (e * (q_i - q_j) - f_lambda * p_u)
+    const Double p = pu[i] + step<O>(params,
+                                     e * (qi[i] - qj[i]) - userLambda * pu[i],
+                                     rows.su, i, n);
+    pu[i] = p;
+    // q_i <- q_i + lr * (e * p_u - f_lambda * q_i)
+    qi[i] += step<O>(params, e * p - itemLambda * qi[i], rows.si, i, n);
+    // q_j <- q_j + lr * (-e * p_u - f_lambda * q_j)
+    qj[i] += step<O>(params, -e * p - itemLambda * qj[i], rows.sj, i, n);
+  }
+}
+
+template <size_t N, Optimizer O>
+void BPREngine::fusedUpdate(const TripletRows& rows) {
+  const size_t n = N > 0 ? N : config_.nfactors;
+  const Double* pu = rows.pu;
+  const Double* qi = rows.qi;
+  const Double* qj = rows.qj;
+  // score difference: b_i - b_j + p_u'(q_i - q_j)
+  Double pred = rows.bi ? *rows.bi - *rows.bj : 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    pred += pu[i] * (qi[i] - qj[i]);
+  }
+  const Double e = lossDerivative(pred);
+  flagNonFinite(e);
+  applyUpdate<N, O>(rows, e);
+}
 }
@@ -18,9 +18,14 @@
 
 #include <algorithm>
 #include <cmath>
+#include <numeric>
 
 namespace qmf {
 
+const size_t BPREngine::shuffleBlockSize;
+const size_t BPREngine::maxNegativeTries;
+const size_t BPREngine::evalStrata;
+
 BPREngine::BPREngine(const BPRConfig& config,
                      const std::unique_ptr<MetricsEngine>& metricsEngine,
                      const size_t evalNumNeg,
@@ -31,14 +36,17 @@ BPREngine::BPREngine(const BPRConfig& config,
     evalNumNeg_(evalNumNeg),
     evalSeed_(evalSeed),
     parallel_(nthreads),
-    gen_(std::random_device()()) {
+    seed_(config_.seed >= 0 ? static_cast<uint64_t>(config_.seed) :
+                              std::random_device()()),
+    gen_(seed_) {
   if (config_.numHogwildThreads > nthreads) {
     LOG(WARNING)
       << "number of hogwild threads should be smaller than number of "
          "threads in the threadpool";
   }
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty() &&
-      metricsEngine_->config().numTestUsers == 0) {
+      metricsEngine_->config().numTestUsers == 0 &&
+      metricsEngine_->config().sampledNegatives == 0) {
     LOG(WARNING) << "computing average test metrics on all users can be slow! "
                     "Set numTestUsers > 0 to sample some of them";
   }
@@ -76,15 +84,51 @@ void BPREngine::init(const std::vector<DatasetElem>& dataset) {
     data_.push_back(PosPair{uidx, pidx});
   }
 
-  itemMap_.resize(userIndex_.size());
+  blockOrder_.resize((data_.size() + shuffleBlockSize - 1) / shuffleBlockSize);
+  std::iota(blockOrder_.begin(), blockOrder_.end(), 0);
+  if (config_.shuffleTrainingSet) {
+    // shuffle blocks only mix their own elements, so the whole dataset is
+    // shuffled once (e.g. in case it is sorted by user)
+    std::shuffle(data_.begin(), data_.end(), gen_);
+  }
+
+  std::vector<std::pair<size_t, size_t>> posPairs;
+  posPairs.reserve(data_.size());
   for (const auto& p : data_) {
-    itemMap_[p.userIdx].insert(p.posItemIdx);
+    posPairs.emplace_back(p.userIdx, p.posItemIdx);
+  }
+  itemSets_ = ItemSets(nusers(), nitems(), posPairs);
+  if (config_.userMajor) {
+    userOrder_.resize(nusers());
+    std::iota(userOrder_.begin(), userOrder_.end(), 0);
+    if (config_.shuffleTrainingSet) {
+      std::shuffle(userOrder_.begin(), userOrder_.end(), gen_);
+    }
+  }
+  if (config_.numStrata > 1) {
+    initStrata();
+  }
+  if (config_.numHotItems > 0) {
+    initHotItems();
+  }
+  CHECK(config_.negativeSampler != NegativeSampler::InBatch ||
+        config_.batchSize > 1)
+    << "the in-batch sampler needs batches of more than one positive";
+  if (config_.negativeSampler == NegativeSampler::Popularity) {
+    std::vector<Double> popularity(nitems());
+    for (const auto& p : data_) {
+      popularity[p.posItemIdx] += 1.0;
+    }
+    for (auto& weight : popularity) {
+      weight = std::pow(weight, config_.popularityExponent);
+    }
+    popularityTable_ = std::make_unique<AliasTable>(popularity);
   }
 
   // generate evaluation set
-  iterate([& evalSet = evalSet_](PosNegTriplet && triplet) {
-    evalSet.push_back(std::move(triplet));
-  }, evalNumNeg_, std::mt19937(evalSeed_));
+  sampleEvalSet(evalSet_, data_.size(), [this](const size_t k) {
+    return std::make_pair(data_[k].userIdx, data_[k].posItemIdx);
+  }, /*useTestItemSets=*/false);
 
   // initialize model
   learningRate_ = config_.initLearningRate;
@@ -102,15 +146,20 @@ void BPREngine::init(const std::vector<DatasetElem>& dataset) {
   if (config_.useBiases) {
     itemFactors_->setBiases(genUnif);
   }
+  if (config_.optimizer != Optimizer::SGD) {
+    const size_t numMoments = config_.optimizer == Optimizer::Adam ? 2 : 1;
+    stateStride_ = numMoments * (config_.nfactors + 1);
+    userState_.assign(nusers() * stateStride_, 0.0f);
+    itemState_.assign(nitems() * stateStride_, 0.0f);
+  }
 }
 
 void BPREngine::initTest(const std::vector<DatasetElem>& testDataset) {
   CHECK(testEvalSet_.empty())
     << "engine was already initialzied with test data";
-  // populate item map
+  // populate item sets
   std::vector<std::pair<size_t, size_t>> validElems;
   validElems.reserve(testDataset.size());
-  testItemMap_.resize(userIndex_.size());
   for (const auto& elem : testDataset) {
     if (elem.value < 1.0) {
       continue;
@@ -120,26 +169,33 @@ void BPREngine::initTest(const std::vector<DatasetElem>& testDataset) {
     if (uidx == IdIndex::missingIdx || pidx == IdIndex::missingIdx) {
       continue;
     }
-    testItemMap_[uidx].insert(pidx);
     validElems.emplace_back(uidx, pidx);
   }
+  testItemSets_ = ItemSets(nusers(), nitems(), validElems);
   // generate evaluation set
-  std::mt19937 gen(evalSeed_);
-  testEvalSet_.reserve(evalNumNeg_ * validElems.size());
-  for (const auto& p : validElems) {
-    for (size_t i = 0; i < evalNumNeg_; ++i) {
-      testEvalSet_.push_back(PosNegTriplet{
-        p.first,
-        p.second,
-        sampleRandomNegative(p.first, gen, /*useTestItemMap=*/true)});
-    }
-  }
+  sampleEvalSet(testEvalSet_, validElems.size(), [&validElems](const size_t k) {
+    return validElems[k];
+  }, /*useTestItemSets=*/true);
 
   // initialize data for test average metrics
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty()) {
-    initAvgTestData(
-      testUsers_, testLabels_, testScores_, testDataset, userIndex_, itemIndex_,
-      metricsEngine_->config().numTestUsers, metricsEngine_->config().seed);
+    if (metricsEngine_->config().sampledNegatives > 0) {
+      initSparseTestData(
+        testUsers_, testPositives_, testDataset, userIndex_, itemIndex_,
+        metricsEngine_->config().numTestUsers, metricsEngine_->config().seed);
+      sampleTestNegatives(testNegatives_, testPositives_, nitems(),
+                          metricsEngine_->config().sampledNegatives,
+                          metricsEngine_->config().seed, parallel_);
+    } else if (metricsEngine_->config().streaming) {
+      initSparseTestData(
+        testUsers_, testPositives_, testDataset, userIndex_, itemIndex_,
+        metricsEngine_->config().numTestUsers, metricsEngine_->config().seed);
+    } else {
+      initAvgTestData(
+        testUsers_, testLabels_, testScores_, testDataset, userIndex_,
+        itemIndex_, metricsEngine_->config().numTestUsers,
+        metricsEngine_->config().seed);
+    }
   }
 }
 
@@ -147,18 +203,55 @@ void BPREngine::optimize() {
   CHECK(userFactors_ && itemFactors_)
     << "no factor data, have you initialized the engine?";
 
+  // each hogwild thread gets its own generator stream, so that threads
+  // neither race on nor share a generator state
+  const size_t numGens = std::max<size_t>(config_.numHogwildThreads, 1);
+  for (size_t i = gens_.size(); i < numGens; ++i) {
+    gens_.emplace_back(seed_, i + 1);
+  }
+  if (!hotItems_.empty() && config_.numHogwildThreads > 1 &&
+      hotItemCaches_.empty()) {
+    hotItemCaches_.resize(config_.numHogwildThreads);
+    for (auto& cache : hotItemCaches_) {
+      // local == base, so that the first merge only loads the hot items
+      cache.local = std::make_unique<FactorData>(
+        hotItems_.size(), config_.nfactors, config_.useBiases);
+      cache.base = std::make_unique<FactorData>(
+        hotItems_.size(), config_.nfactors, config_.useBiases);
+    }
+  }
+
   for (size_t epoch = 1; epoch <= config_.nepochs; ++epoch) {
+    if (config_.negativeSampler == NegativeSampler::Adaptive) {
+      rankItemsByFactor();
+    }
+
     // run SGD
-    auto updateOne = [this](const auto& triplet) { update(triplet); };
-    if (config_.numHogwildThreads <= 1) {
-      iterate(updateOne, config_.numNegativeSamples, gen_);
+    if (config_.numStrata > 1) {
+      runStrata(epoch);
+    } else if (config_.userMajor) {
+      const size_t numTasks = gens_.size();
+      const size_t nusers = userOrder_.size();
+      auto func = [this, numTasks, nusers](const size_t taskId) {
+        auto gen = gens_[taskId];
+        runUsers(taskId * nusers / numTasks,
+                 (taskId + 1) * nusers / numTasks, gen);
+        gens_[taskId] = gen;
+      };
+      parallel_.execute(numTasks, func);
+    } else if (config_.numHogwildThreads <= 1) {
+      runBlocks(0, blockOrder_.size(), gens_[0]);
     } else {
       const size_t numTasks = config_.numHogwildThreads;
-      const size_t blockSize = data_.size() / numTasks;
-      auto func = [this, numTasks, blockSize, updateOne](const size_t taskId) {
-        iterateBlock(updateOne, taskId * blockSize,
-                     std::min(data_.size(), (taskId + 1) * blockSize),
-                     config_.numNegativeSamples, gen_);
+      const size_t nblocks = blockOrder_.size();
+      auto func = [this, numTasks, nblocks](const size_t taskId) {
+        // use a local copy of the generator, to avoid false sharing
+        auto gen = gens_[taskId];
+        HotItemCache* cache =
+          hotItemCaches_.empty() ? nullptr : &hotItemCaches_[taskId];
+        runBlocks(taskId * nblocks / numTasks,
+                  (taskId + 1) * nblocks / numTasks, gen, cache);
+        gens_[taskId] = gen;
       };
       parallel_.execute(numTasks, func);
     }
@@ -169,67 +262,355 @@ void BPREngine::optimize() {
     if (config_.decayRate < 1.0) {
       learningRate_ *= config_.decayRate;
     }
-    if (config_.shuffleTrainingSet) {
-      shuffle();
+    if (config_.shuffleTrainingSet && config_.numStrata <= 1) {
+      if (config_.userMajor) {
+        std::shuffle(userOrder_.begin(), userOrder_.end(), gen_);
+      } else {
+        shuffle();
+      }
     }
   }
+  waitForEvaluation();
 }
 
-void BPREngine::update(const PosNegTriplet& triplet) {
-  const size_t uidx = triplet.userIdx;
-  const size_t pidx = triplet.posItemIdx;
-  const size_t nidx = triplet.negItemIdx;
+void BPREngine::rankItemsByFactor() {
+  const size_t n = nitems();
+  factorRankings_.resize(config_.nfactors * n);
+  factorStddevs_.resize(config_.nfactors);
+  auto rankOne = [this, n](const size_t f) {
+    uint32_t* ranking = factorRankings_.data() + f * n;
+    std::iota(ranking, ranking + n, 0);
+    std::sort(ranking, ranking + n, [this, f](uint32_t i, uint32_t j) {
+      return itemFactors_->at(i, f) > itemFactors_->at(j, f);
+    });
+    Double sum = 0.0;
+    Double sumSquares = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+      sum += itemFactors_->at(i, f);
+      sumSquares += itemFactors_->at(i, f) * itemFactors_->at(i, f);
+    }
+    const Double mean = sum / n;
+    factorStddevs_[f] = std::sqrt(std::max(sumSquares / n - mean * mean, 0.0));
+  };
+  parallel_.execute(config_.nfactors, rankOne);
+}
 
-  const Double e = lossDerivative(predictDifference(uidx, pidx, nidx));
-  CHECK(std::isfinite(e)) << "gradients too big, try decreasing the learning "
-                             "rate (--init_learning_rate)";
-  const Double lr = learningRate_;
+void BPREngine::initStrata() {
+  const size_t p = config_.numStrata;
+  CHECK_LE(p, std::min(nusers(), nitems()))
+    << "there should be at least as many users and items as strata";
+  // counting sort of the data by block
+  auto blockOf = [this, p](const PosPair& pair) {
+    return (pair.userIdx * p / nusers()) * p + pair.posItemIdx * p / nitems();
+  };
+  strataOffsets_.assign(p * p + 1, 0);
+  for (const auto& pair : data_) {
+    ++strataOffsets_[blockOf(pair) + 1];
+  }
+  for (size_t b = 0; b < p * p; ++b) {
+    strataOffsets_[b + 1] += strataOffsets_[b];
+  }
+  strataData_.resize(data_.size());
+  std::vector<size_t> pos(strataOffsets_.begin(), strataOffsets_.end() - 1);
+  for (const auto& pair : data_) {
+    strataData_[pos[blockOf(pair)]++] = pair;
+  }
+}
 
-  // update biases
-  if (config_.useBiases) {
-    // b_i <- b_i + lr * (e - b_lambda * b_i)
-    Double step = lr * (e - config_.biasLambda * itemFactors_->biasAt(pidx));
-    itemFactors_->biasAt(pidx) += step;
-    // b_j <- b_j + b_lr * (-e - b_lambda * b_j)
-    step = lr * (-e - config_.biasLambda * itemFactors_->biasAt(nidx));
-    itemFactors_->biasAt(nidx) += step;
+void BPREngine::runStrata(const size_t epoch) {
+  const size_t p = config_.numStrata;
+  for (size_t round = 0; round < p; ++round) {
+    // user block k is paired with item block (k + round) % p
+    auto runGridBlock = [this, p, epoch, round](const size_t userBlock) {
+      const size_t itemBlock = (userBlock + round) % p;
+      const size_t block = userBlock * p + itemBlock;
+      Xoshiro256 gen(seed_, (epoch * p + userBlock) * p + itemBlock);
+      auto first = strataData_.begin() + strataOffsets_[block];
+      auto last = strataData_.begin() + strataOffsets_[block + 1];
+      if (config_.shuffleTrainingSet) {
+        std::shuffle(first, last, gen);
+      }
+      const size_t itemBegin = strataBound(itemBlock, nitems());
+      const size_t itemEnd = strataBound(itemBlock + 1, nitems());
+      runTriplets([&](auto&& func) {
+        for (auto it = first; it != last; ++it) {
+          for (size_t j = 0; j < config_.numNegativeSamples; ++j) {
+            const size_t negItemIdx =
+              sampleRandomNegativeInRange(it->userIdx, itemBegin, itemEnd, gen);
+            if (negItemIdx == IdIndex::missingIdx) {
+              break;
+            }
+            func(PosNegTriplet{it->userIdx, it->posItemIdx, negItemIdx});
+          }
+        }
+      });
+      checkGradients();
+    };
+    parallel_.execute(p, runGridBlock);
   }
+}
 
-  // update user factors
-  // p_u <- p_u + lr * (e * (q_i - q_j) - f_lambda * p_u)
-  for (size_t i = 0; i < config_.nfactors; ++i) {
-    const Double step =
-      lr * (e * (itemFactors_->at(pidx, i) - itemFactors_->at(nidx, i)) -
-            config_.userLambda * userFactors_->at(uidx, i));
-    userFactors_->at(uidx, i) += step;
+void BPREngine::updateInBatch(const std::vector<PosPair>& batch,
+                              Xoshiro256& gen) {
+  if (batch.empty()) {
+    return;
   }
-  // update pos item factors
-  // q_i <- q_i + lr * (e * p_u - f_lambda * q_i)
-  for (size_t i = 0; i < config_.nfactors; ++i) {
-    const Double step = lr * (e * userFactors_->at(uidx, i) -
-                              config_.itemLambda * itemFactors_->at(pidx, i));
-    itemFactors_->at(pidx, i) += step;
+  const size_t n = config_.nfactors;
+  const FactorData& items = *itemFactors_;
+  const size_t poolSize = std::max<size_t>(config_.inBatchPoolSize, 1);
+  std::uniform_int_distribution<size_t> itemDistr(0, nitems() - 1);
+  std::vector<size_t> pool(poolSize);
+  for (auto& itemIdx : pool) {
+    itemIdx = itemDistr(gen);
   }
-  // update neg item factors
-  // q_j <- q_j + lr * (-e * p_u - f_lambda * q_j)
-  for (size_t i = 0; i < config_.nfactors; ++i) {
-    const Double step = lr * (-e * userFactors_->at(uidx, i) -
-                              config_.itemLambda * itemFactors_->at(nidx, i));
-    itemFactors_->at(nidx, i) += step;
+
+  // scores of the pool items for all users of the batch, each pool item row
+  // being read once for the whole batch
+  Matrix users(batch.size(), n);
+  Matrix poolItems(poolSize, n);
+  for (size_t b = 0; b < batch.size(); ++b) {
+    const Double* pu = userFactors_->row(batch[b].userIdx);
+    std::copy(pu, pu + n, users.data() + b * n);
+  }
+  for (size_t m = 0; m < poolSize; ++m) {
+    const Double* qj = itemFactors_->row(pool[m]);
+    std::copy(qj, qj + n, poolItems.data() + m * n);
+  }
+  Matrix scores(batch.size(), poolSize);
+  for (size_t b = 0; b < batch.size(); ++b) {
+    const Double* pu = users.data() + b * n;
+    for (size_t m = 0; m < poolSize; ++m) {
+      const Double* qj = poolItems.data() + m * n;
+      Double score = 0.0;
+      for (size_t i = 0; i < n; ++i) {
+        score += pu[i] * qj[i];
+      }
+      scores(b, m) = score + items.biasAt(pool[m]);
+    }
+  }
+
+  // all gradients are computed from the factors before the batch
+  std::vector<PosNegTriplet> triplets;
+  std::vector<Double> grads;
+  triplets.reserve(batch.size() * config_.numNegativeSamples);
+  grads.reserve(batch.size() * config_.numNegativeSamples);
+  std::uniform_int_distribution<size_t> poolDistr(0, poolSize - 1);
+  for (size_t b = 0; b < batch.size(); ++b) {
+    const size_t uidx = batch[b].userIdx;
+    const size_t pidx = batch[b].posItemIdx;
+    const Double* pu = users.data() + b * n;
+    const Double* qi = itemFactors_->row(pidx);
+    Double posScore = items.biasAt(pidx);
+    for (size_t i = 0; i < n; ++i) {
+      posScore += pu[i] * qi[i];
+    }
+    for (size_t j = 0; j < config_.numNegativeSamples; ++j) {
+      size_t nidx = IdIndex::missingIdx;
+      Double negScore = 0.0;
+      for (size_t t = 0; t < maxNegativeTries; ++t) {
+        const size_t m = poolDistr(gen);
+        if (!itemSets_.contains(uidx, pool[m])) {
+          nidx = pool[m];
+          negScore = scores(b, m);
+          break;
+        }
+      }
+      if (nidx == IdIndex::missingIdx) {
+        nidx = sampleRandomNegative(uidx, gen);
+        negScore = posScore - predictDifference(uidx, pidx, nidx);
+      }
+      const Double e = lossDerivative(posScore - negScore);
+      flagNonFinite(e);
+      triplets.push_back(PosNegTriplet{uidx, pidx, nidx});
+      grads.push_back(e);
+    }
+  }
+  for (size_t k = 0; k < triplets.size(); ++k) {
+    update(triplets[k], grads[k]);
   }
 }
 
+void BPREngine::runUsers(const size_t first,
+                         const size_t last,
+                         Xoshiro256& gen) {
+  const size_t n = config_.nfactors;
+  std::vector<Double> pu(n);
+  std::vector<uint32_t> positives;
+  for (size_t k = first; k < last; ++k) {
+    const size_t uidx = userOrder_[k];
+    positives.assign(itemSets_.begin(uidx), itemSets_.end(uidx));
+    std::shuffle(positives.begin(), positives.end(), gen);
+    Double* row = userFactors_->row(uidx);
+    std::copy(row, row + n, pu.begin());
+    for (const size_t pidx : positives) {
+      for (size_t j = 0; j < config_.numNegativeSamples; ++j) {
+        update(uidx, pu.data(), pidx, sampleNegative(uidx, gen));
+      }
+    }
+    std::copy(pu.begin(), pu.end(), row);
+    checkGradients();
+  }
+}
+
+size_t BPREngine::strataBound(const size_t block, const size_t n) const {
+  // smallest index i such that i * numStrata / n >= block
+  const size_t p = config_.numStrata;
+  return (block * n + p - 1) / p;
+}
+
+void BPREngine::initHotItems() {
+  std::vector<size_t> counts(nitems());
+  for (const auto& p : data_) {
+    ++counts[p.posItemIdx];
+  }
+  std::vector<size_t> items(nitems());
+  std::iota(items.begin(), items.end(), 0);
+  const size_t nhot = std::min<size_t>(config_.numHotItems, nitems());
+  std::partial_sort(items.begin(), items.begin() + nhot, items.end(),
+                    [&counts](const size_t i, const size_t j) {
+                      return counts[i] > counts[j] ||
+                             (counts[i] == counts[j] && i < j);
+                    });
+  hotItems_.assign(items.begin(), items.begin() + nhot);
+  hotItemSlots_.assign(nitems(), IdIndex::missingIdx);
+  for (size_t slot = 0; slot < hotItems_.size(); ++slot) {
+    hotItemSlots_[hotItems_[slot]] = slot;
+  }
+}
+
+void BPREngine::syncHotItems(HotItemCache& cache) {
+  FactorData& local = *cache.local;
+  FactorData& base = *cache.base;
+  for (size_t slot = 0; slot < hotItems_.size(); ++slot) {
+    Double* q = itemFactors_->row(hotItems_[slot]);
+    Double* ql = local.row(slot);
+    Double* qb = base.row(slot);
+    for (size_t i = 0; i < config_.nfactors; ++i) {
+      q[i] += ql[i] - qb[i];
+      ql[i] = qb[i] = q[i];
+    }
+    if (config_.useBiases) {
+      Double& b = itemFactors_->biasAt(hotItems_[slot]);
+      b += local.biasAt(slot) - base.biasAt(slot);
+      local.biasAt(slot) = base.biasAt(slot) = b;
+    }
+  }
+  cache.sinceSync = 0;
+}
+
+void BPREngine::update(const PosNegTriplet& triplet, HotItemCache* cache) {
+  update(triplet.userIdx, userFactors_->row(triplet.userIdx),
+         triplet.posItemIdx, triplet.negItemIdx, cache);
+}
+
+void BPREngine::update(const size_t userIdx,
+                       Double* pu,
+                       const size_t pidx,
+                       const size_t nidx,
+                       HotItemCache* cache) {
+  const TripletRows rows = tripletRows(userIdx, pu, pidx, nidx, cache);
+  withKernel([this, &rows](auto nfactors, auto optimizer) {
+    fusedUpdate<decltype(nfactors)::value, decltype(optimizer)::value>(rows);
+  });
+}
+
+BPREngine::TripletRows BPREngine::tripletRows(const size_t userIdx,
+                                              Double* pu,
+                                              const size_t pidx,
+                                              const size_t nidx,
+                                              HotItemCache* cache) {
+  // hot items use the shared optimizer state
+  const auto pos = itemRow(pidx, cache);
+  const auto neg = itemRow(nidx, cache);
+  return TripletRows{pu,
+                     pos.first->row(pos.second),
+                     neg.first->row(neg.second),
+                     itemBias(pos),
+                     itemBias(neg),
+                     userState(userIdx),
+                     itemState(pidx),
+                     itemState(nidx)};
+}
+
+void BPREngine::checkGradients() const {
+  CHECK(!nonFinite_.load(std::memory_order_relaxed))
+    << "gradients too big, try decreasing the learning rate "
+       "(--init_learning_rate)";
+}
+
+void BPREngine::updateBatch(const std::vector<PosNegTriplet>& batch,
+                            std::vector<Double>& grads,
+                            HotItemCache* cache) {
+  const size_t rowSize = config_.nfactors * sizeof(Double);
+  auto prefetchRow = [rowSize](const Double* row) {
+    const char* p = reinterpret_cast<const char*>(row);
+    for (size_t offset = 0; offset < rowSize; offset += 64) {
+      __builtin_prefetch(p + offset, /*rw=*/1);
+    }
+  };
+  for (const auto& triplet : batch) {
+    prefetchRow(userFactors_->row(triplet.userIdx));
+    const auto pos = itemRow(triplet.posItemIdx, cache);
+    prefetchRow(pos.first->row(pos.second));
+    const auto neg = itemRow(triplet.negItemIdx, cache);
+    prefetchRow(neg.first->row(neg.second));
+  }
+
+  // all gradients are computed from the factors before the batch
+  for (size_t k = 0; k < batch.size(); ++k) {
+    const auto& triplet = batch[k];
+    grads[k] = lossDerivative(
+      predictDifference(userFactors_->row(triplet.userIdx),
+                        triplet.posItemIdx, triplet.negItemIdx, cache));
+    flagNonFinite(grads[k]);
+  }
+  for (size_t k = 0; k < batch.size(); ++k) {
+    update(batch[k], grads[k], cache);
+  }
+}
+
+void BPREngine::update(const PosNegTriplet& triplet,
+                       const Double e,
+                       HotItemCache* cache) {
+  update(triplet.userIdx, userFactors_->row(triplet.userIdx),
+         triplet.posItemIdx, triplet.negItemIdx, e, cache);
+}
+
+void BPREngine::update(const size_t userIdx,
+                       Double* pu,
+                       const size_t pidx,
+                       const size_t nidx,
+                       const Double e,
+                       HotItemCache* cache) {
+  const TripletRows rows = tripletRows(userIdx, pu, pidx, nidx, cache);
+  withKernel([this, &rows, e](auto nfactors, auto optimizer) {
+    applyUpdate<decltype(nfactors)::value, decltype(optimizer)::value>(rows,
+                                                                       e);
+  });
+}
+
 Double BPREngine::predictDifference(const size_t userIdx,
                                     const size_t posItemIdx,
                                     const size_t negItemIdx) const {
+  return predictDifference(
+    userFactors_->row(userIdx), posItemIdx, negItemIdx);
+}
+
+Double BPREngine::predictDifference(const Double* pu,
+                                    const size_t posItemIdx,
+                                    const size_t negItemIdx,
+                                    const HotItemCache* cache) const {
+  const auto pos = itemRow(posItemIdx, cache);
+  const auto neg = itemRow(negItemIdx, cache);
   // score difference: b_i - b_j + p_u'(q_i - q_j)
   Double pred = 0.0;
   if (config_.useBiases) {
-    pred += itemFactors_->biasAt(posItemIdx) - itemFactors_->biasAt(negItemIdx);
+    pred += pos.first->biasAt(pos.second) - neg.first->biasAt(neg.second);
   }
+  const Double* qi = pos.first->row(pos.second);
+  const Double* qj = neg.first->row(neg.second);
   for (size_t i = 0; i < config_.nfactors; ++i) {
-    pred += userFactors_->at(userIdx, i) *
-            (itemFactors_->at(posItemIdx, i) - itemFactors_->at(negItemIdx, i));
+    pred += pu[i] * (qi[i] - qj[i]);
   }
   return pred;
 }
@@ -239,8 +620,8 @@ Double BPREngine::loss(const Double scoreDifference) const {
 }
 
 Double BPREngine::lossDerivative(const Double scoreDifference) const {
-  // e = d/dx log sigmoid(x) = 1 / (1 + exp(x))
-  return 1.0 / (1.0 + exp(scoreDifference));
+  // e = d/dx log sigmoid(x) = 1 / (1 + exp(x)) = sigmoid(-x)
+  return sigmoid_(-scoreDifference);
 }
 
 void BPREngine::evaluate(const size_t epoch) {
@@ -266,14 +647,61 @@ void BPREngine::evaluate(const size_t epoch) {
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty() &&
       !testUsers_.empty() &&
       (metricsEngine_->config().alwaysCompute || epoch == config_.nepochs)) {
+    if (metricsEngine_->config().async) {
+      // the next epoch updates the factors while they're being evaluated, so
+      // the evaluation reads a snapshot of them, once the previous one is done
+      waitForEvaluation();
+      if (!evalUserFactors_) {
+        evalUserFactors_ = std::make_unique<FactorData>(*userFactors_);
+        evalItemFactors_ = std::make_unique<FactorData>(*itemFactors_);
+      } else {
+        evalUserFactors_->copyFrom(*userFactors_);
+        evalItemFactors_->copyFrom(*itemFactors_);
+      }
+      evaluateAsync(
+        metricsEngine_->config().asyncNthreads,
+        [this, epoch](ParallelExecutor& parallel) {
+          evaluateTestAvgMetrics(
+            epoch, *evalUserFactors_, *evalItemFactors_, parallel);
+        });
+    } else {
+      evaluateTestAvgMetrics(epoch, *userFactors_, *itemFactors_, parallel_);
+    }
+  }
+}
+
+void BPREngine::evaluateTestAvgMetrics(const size_t epoch,
+                                       const FactorData& userFactors,
+                                       const FactorData& itemFactors,
+                                       ParallelExecutor& parallel) {
+  if (metricsEngine_->config().sampledNegatives > 0) {
+    computeSampledTestRanks(testRanks_, testNitems_, testUsers_,
+                            testPositives_, testNegatives_, userFactors,
+                            itemFactors, parallel);
+    metricsEngine_->computeAndRecordTestAvgMetrics(
+      epoch, testRanks_, testNitems_, parallel);
+  } else if (metricsEngine_->config().streaming) {
+    computeTestRanks(testRanks_, testUsers_, testPositives_, userFactors,
+                     itemFactors, parallel);
+    size_t nitems = itemFactors.nelems();
+    metricsEngine_->computeAndRecordTestAvgMetrics(
+      epoch, testRanks_, nitems, parallel);
+  } else {
     computeTestScores(
-      testScores_, testUsers_, *userFactors_, *itemFactors_, parallel_);
+      testScores_, testUsers_, userFactors, itemFactors, parallel);
     metricsEngine_->computeAndRecordTestAvgMetrics(
-      epoch, testLabels_, testScores_, parallel_);
+      epoch, testLabels_, testScores_, parallel);
   }
 }
 
 void BPREngine::shuffle() {
-  std::shuffle(data_.begin(), data_.end(), gen_);
+  const uint64_t seed = gen_();
+  auto shuffleOne = [this, seed](const size_t block) {
+    Xoshiro256 gen(seed, block);
+    std::shuffle(data_.begin() + blockStart(block),
+                 data_.begin() + blockStart(block + 1), gen);
+  };
+  parallel_.execute(blockOrder_.size(), shuffleOne);
+  std::shuffle(blockOrder_.begin(), blockOrder_.end(), gen_);
 }
 }
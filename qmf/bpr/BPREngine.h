@@ -16,18 +16,24 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <memory>
 #include <random>
+#include <type_traits>
 #include <vector>
-#include <unordered_map>
-#include <unordered_set>
 
 #include <qmf/Engine.h>
 #include <qmf/FactorData.h>
 #include <qmf/metrics/MetricsEngine.h>
 #include <qmf/Types.h>
+#include <qmf/utils/AliasTable.h>
+#include <qmf/utils/FastSigmoid.h>
 #include <qmf/utils/IdIndex.h>
+#include <qmf/utils/ItemSets.h>
 #include <qmf/utils/ParallelExecutor.h>
+#include <qmf/utils/Random.h>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -35,6 +41,34 @@
 
 namespace qmf {
 
+// distribution of the negatives sampled for training
+enum class NegativeSampler {
+  // uniform over the items
+  Uniform,
+  // proportional to popularity^popularityExponent
+  Popularity,
+  // items ranked high by the current user factors (Rendle & Freudenthaler,
+  // Improving Pairwise Learning for Item Recommendation from Implicit
+  // Feedback, WSDM 2014)
+  Adaptive,
+  // uniform, but the positives of a batch share a pool of sampled items, so
+  // that their scores are computed with a small dense product
+  InBatch,
+};
+
+// rule for the size of the sgd steps
+enum class Optimizer {
+  // global learning rate, decayed after each epoch
+  SGD,
+  // learning rate divided by the root of the sum of the squared gradients of
+  // each parameter
+  Adagrad,
+  // learning rate times the running average of the gradients divided by the
+  // root of the running average of their squares, both updated only when the
+  // parameter is (lazy Adam, without bias correction)
+  Adam,
+};
+
 struct BPRConfig {
   size_t nepochs;
   size_t nfactors;
@@ -48,6 +82,41 @@ struct BPRConfig {
   size_t numNegativeSamples;
   size_t numHogwildThreads;
   bool shuffleTrainingSet;
+  // seed of the random generators used for training (-1 = random seed)
+  int64_t seed = -1;
+  // number of triplets whose gradients are computed together before applying
+  // their updates (1 = update after each triplet)
+  size_t batchSize = 1;
+  // if > 1, users and items are split into this many blocks each, and the
+  // epochs run in numStrata rounds where each worker updates its own block
+  // of the grid, so that updates never conflict (instead of hogwild)
+  size_t numStrata = 0;
+  // sampler for the negatives (when numStrata <= 1)
+  NegativeSampler negativeSampler = NegativeSampler::Uniform;
+  Double popularityExponent = 0.75;
+  // the adaptive sampler picks ranks from a geometric distribution with this
+  // mean, as a fraction of the number of items
+  Double adaptiveRankScale = 0.05;
+  // number of items in the shared pool of the in-batch sampler
+  size_t inBatchPoolSize = 64;
+  // if true, all the triplets of a user are processed consecutively (users
+  // and their positives in random order), on a local copy of the user
+  // factors that is written back once
+  bool userMajor = false;
+  // if > 0, each hogwild thread updates its own copies of this many most
+  // popular items, and merges its changes to them every
+  // hotItemSyncInterval triplets
+  size_t numHotItems = 0;
+  size_t hotItemSyncInterval = 10000;
+  // the adaptive optimizers keep their accumulators in single precision
+  Optimizer optimizer = Optimizer::SGD;
+  Double adamBeta1 = 0.9;
+  Double adamBeta2 = 0.999;
+  // added to the denominator of the adaptive steps
+  Double optimizerEpsilon = 1e-8;
+  // maximum size of the evaluation sets used for the train/test loss
+  // (0 = no limit)
+  size_t evalMaxTriplets = 0;
 };
 
 class BPREngine : public Engine {
@@ -58,6 +127,10 @@ class BPREngine : public Engine {
                      const int32_t evalSeed = 42,
                      const size_t nthreads = 16);
 
+  ~BPREngine() override {
+    waitForEvaluation();
+  }
+
   void init(const std::vector<DatasetElem>& dataset) override;
 
   void initTest(const std::vector<DatasetElem>& testDataset) override;
@@ -86,28 +159,230 @@ class BPREngine : public Engine {
     size_t negItemIdx;
   };
 
-  // for storing the set of positive items of a given user
-  using ItemMap = std::vector<std::unordered_set<size_t>>;
+  // copies of the hot items owned by a hogwild thread, which are updated
+  // instead of the shared ones and merged back periodically
+  struct HotItemCache {
+    std::unique_ptr<FactorData> local; // factors being updated
+    std::unique_ptr<FactorData> base; // factors at the last merge
+    size_t sinceSync = 0; // number of triplets since the last merge
+  };
+
+  // in all the functions below, hot items are read from and written to
+  // `cache` if it is given
 
   // sgd update on an example triplet
-  void update(const PosNegTriplet& triplet);
+  void update(const PosNegTriplet& triplet, HotItemCache* cache = nullptr);
+
+  // sgd update on an example triplet, given the derivative of its loss
+  void update(const PosNegTriplet& triplet,
+              const Double e,
+              HotItemCache* cache = nullptr);
+
+  // sgd update on an example triplet, with the user factors in pu
+  void update(const size_t userIdx,
+              Double* pu,
+              const size_t posItemIdx,
+              const size_t negItemIdx,
+              HotItemCache* cache = nullptr);
+
+  // same as above, given the derivative of its loss
+  void update(const size_t userIdx,
+              Double* pu,
+              const size_t posItemIdx,
+              const size_t negItemIdx,
+              const Double e,
+              HotItemCache* cache = nullptr);
+
+  // computes the loss derivatives of all triplets of the batch (prefetching
+  // their rows first), then applies their updates
+  void updateBatch(const std::vector<PosNegTriplet>& batch,
+                   std::vector<Double>& grads,
+                   HotItemCache* cache = nullptr);
+
+  // runs sgd on the triplets generated by `iterate`, one triplet or one batch
+  // at a time. `iterate`'s signature is void(FuncT func), and it should call
+  // func(triplet) for each triplet
+  template <typename IterateT>
+  void runTriplets(IterateT iterate, HotItemCache* cache = nullptr);
+
+  // runs sgd on the shuffle blocks blockOrder_[first, last)
+  template <typename GenT>
+  void runBlocks(const size_t first,
+                 const size_t last,
+                 GenT&& gen,
+                 HotItemCache* cache = nullptr);
+
+  // picks the config_.numHotItems items with the most positives
+  void initHotItems();
+
+  // adds the changes of the cached hot items since the last merge to
+  // itemFactors_, and reloads them from itemFactors_
+  void syncHotItems(HotItemCache& cache);
+
+  // the data and index of the row of an item, in the cache if it is hot
+  std::pair<FactorData*, size_t> itemRow(const size_t itemIdx,
+                                         const HotItemCache* cache) const {
+    if (cache) {
+      const size_t slot = hotItemSlots_[itemIdx];
+      if (slot != IdIndex::missingIdx) {
+        return {cache->local.get(), slot};
+      }
+    }
+    return {itemFactors_.get(), itemIdx};
+  }
+
+  // bias of an item row given by itemRow(), null without biases
+  Double* itemBias(const std::pair<FactorData*, size_t>& row) const {
+    return config_.useBiases ? &row.first->biasAt(row.second) : nullptr;
+  }
+
+  // everything the update of a triplet reads and writes: the user row pu,
+  // the item rows qi and qj, their biases bi and bj (null without biases),
+  // and the optimizer states of the three rows (null with sgd)
+  struct TripletRows {
+    Double* pu;
+    Double* qi;
+    Double* qj;
+    Double* bi;
+    Double* bj;
+    float* su;
+    float* si;
+    float* sj;
+  };
+
+  TripletRows tripletRows(const size_t userIdx,
+                          Double* pu,
+                          const size_t posItemIdx,
+                          const size_t negItemIdx,
+                          HotItemCache* cache);
+
+  // optimizer state of a row: the accumulators of its nfactors factors and of
+  // its bias, twice for adam (first and second moments)
+  float* userState(const size_t userIdx) {
+    return userState_.empty() ? nullptr
+                              : userState_.data() + userIdx * stateStride_;
+  }
+  float* itemState(const size_t itemIdx) {
+    return itemState_.empty() ? nullptr
+                              : itemState_.data() + itemIdx * stateStride_;
+  }
+
+  // calls func(std::integral_constant<size_t, N>(),
+  //           std::integral_constant<Optimizer, O>()),
+  // with O = config_.optimizer, and N = config_.nfactors if the kernels below
+  // are specialized for it, N = 0 otherwise
+  template <typename FuncT>
+  void withKernel(FuncT func) const;
+
+  struct StepParams {
+    Double lr;
+    Double beta1;
+    Double beta2;
+    Double epsilon;
+  };
+
+  StepParams stepParams() const {
+    return {learningRate_, config_.adamBeta1, config_.adamBeta2,
+            config_.optimizerEpsilon};
+  }
+
+  // returns the change of parameter k of a row with n factors, given its
+  // gradient g, and updates the optimizer state of the row
+  template <Optimizer O>
+  static Double step(const StepParams& params,
+                     const Double g,
+                     float* state,
+                     const size_t k,
+                     const size_t n);
+
+  // applies the update of a triplet with loss derivative e. if N > 0, it is
+  // the number of factors, so that the loop over the factors is fully
+  // unrolled
+  template <size_t N, Optimizer O>
+  void applyUpdate(const TripletRows& rows, const Double e);
+
+  // computes the loss derivative of a triplet and applies its update, in one
+  // pass over the rows for the score and one for the update
+  template <size_t N, Optimizer O>
+  void fusedUpdate(const TripletRows& rows);
+
+  // records non-finite loss derivatives, which are reported by checkGradients
+  // (once per block rather than on every update)
+  void flagNonFinite(const Double e) {
+    if (!std::isfinite(e)) {
+      nonFinite_.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  // fails if a non-finite loss derivative was seen
+  void checkGradients() const;
+
+  // first index of the given shuffle block in data_
+  size_t blockStart(const size_t block) const {
+    return std::min(block * shuffleBlockSize, data_.size());
+  }
+
+  // samples the negatives of the positives of the batch from a shared pool of
+  // random items, computes all the gradients, then applies their updates
+  void updateInBatch(const std::vector<PosPair>& batch, Xoshiro256& gen);
+
+  // runs sgd on the triplets of users userOrder_[first, last), one user at a
+  // time
+  void runUsers(const size_t first, const size_t last, Xoshiro256& gen);
+
+  // groups the data by block of the numStrata x numStrata grid
+  void initStrata();
+
+  // runs one epoch of sgd in stratified mode, where the blocks of each round
+  // are disjoint in both users and items. the random generators are derived
+  // from the seed, epoch and block, so that the results don't depend on the
+  // number of threads
+  void runStrata(const size_t epoch);
+
+  // first index of the given block, when splitting n elements into
+  // numStrata blocks
+  size_t strataBound(const size_t block, const size_t n) const;
 
   // compute score difference
   Double predictDifference(const size_t userIdx,
                            const size_t posItemIdx,
                            const size_t negItemIdx) const;
 
+  // same as above, with the user factors in pu
+  Double predictDifference(const Double* pu,
+                           const size_t posItemIdx,
+                           const size_t negItemIdx,
+                           const HotItemCache* cache = nullptr) const;
+
   // loss function
   Double loss(const Double scoreDifference) const;
 
   // derivative of the loss
   Double lossDerivative(const Double scoreDifference) const;
 
-  // randomly shuffle dataset
+  // randomly shuffle dataset: each shuffle block is shuffled in parallel, and
+  // the order in which blocks are traversed is shuffled
   void shuffle();
 
-  template <typename FuncT, typename GenT>
-  void iterate(FuncT func, const size_t numNeg, GenT&& gen) const;
+  // computes and records the test average metrics of the given factors
+  void evaluateTestAvgMetrics(const size_t epoch,
+                              const FactorData& userFactors,
+                              const FactorData& itemFactors,
+                              ParallelExecutor& parallel);
+
+  // fills evalSet with evalNumNeg_ random negatives for each of at most
+  // config_.evalMaxTriplets / evalNumNeg_ of the npositives positives, where
+  // positive(k) returns the (user, item) pair of positive k. the positives
+  // are split into evalStrata strata, which are sampled in parallel with
+  // generators derived from evalSeed_, so that the result doesn't depend on
+  // the number of threads
+  template <typename PositiveT>
+  void sampleEvalSet(std::vector<PosNegTriplet>& evalSet,
+                     const size_t npositives,
+                     PositiveT positive,
+                     const bool useTestItemSets);
+
+  static const size_t evalStrata = 256;
 
   template <typename FuncT, typename GenT>
   void iterateBlock(FuncT func,
@@ -116,10 +391,35 @@ class BPREngine : public Engine {
                     const size_t numNeg,
                     GenT&& gen) const;
 
+  // non-uniform samplers fall back to uniform sampling for users that have
+  // many of the likely negatives as positives, after this many rejections
+  static const size_t maxNegativeTries = 32;
+
+  // samples a negative for training, with config_.negativeSampler
+  template <typename GenT>
+  size_t sampleNegative(const size_t userIdx, GenT&& gen) const;
+
+  // samples the item ranked at a random (geometrically distributed) rank for
+  // a random factor of the user, weighted by how much it contributes to the
+  // user's scores
+  template <typename GenT>
+  size_t sampleAdaptiveNegative(const size_t userIdx, GenT&& gen) const;
+
+  // ranks the items by each factor, for the adaptive sampler
+  void rankItemsByFactor();
+
   template <typename GenT>
   size_t sampleRandomNegative(const size_t userIdx,
                               GenT&& gen,
-                              const bool useTestItemMap = false) const;
+                              const bool useTestItemSets = false) const;
+
+  // samples a negative within [itemBegin, itemEnd), returns
+  // IdIndex::missingIdx if all the items in the range are positives
+  template <typename GenT>
+  size_t sampleRandomNegativeInRange(const size_t userIdx,
+                                     const size_t itemBegin,
+                                     const size_t itemEnd,
+                                     GenT&& gen) const;
 
   const BPRConfig& config_;
   const std::unique_ptr<MetricsEngine>& metricsEngine_;
@@ -128,17 +428,55 @@ class BPREngine : public Engine {
 
   ParallelExecutor parallel_;
 
-  std::mt19937 gen_;
+  const uint64_t seed_;
+  // for initialization and shuffling
+  Xoshiro256 gen_;
+  // for sampling negatives, one per hogwild thread
+  std::vector<Xoshiro256> gens_;
 
   Double learningRate_;
 
+  // for the loss derivative
+  const FastSigmoid sigmoid_;
+  // set when a non-finite loss derivative is seen
+  std::atomic<bool> nonFinite_{false};
+
+  // states of the adaptive optimizers, stateStride_ per row in the same order
+  // as the factors
+  size_t stateStride_ = 0;
+  std::vector<float> userState_;
+  std::vector<float> itemState_;
+
   std::vector<PosPair> data_;
 
+  // data_ is split into blocks of shuffleBlockSize elements, traversed in the
+  // order given by blockOrder_
+  static const size_t shuffleBlockSize = 1 << 15;
+  std::vector<size_t> blockOrder_;
+
+  // order of the users, for the user-major traversal
+  std::vector<size_t> userOrder_;
+
+  // for the stratified mode, the data of block b of the grid is in
+  // strataData_[strataOffsets_[b], strataOffsets_[b + 1])
+  std::vector<PosPair> strataData_;
+  std::vector<size_t> strataOffsets_;
+
   std::vector<PosNegTriplet> evalSet_;
   std::vector<PosNegTriplet> testEvalSet_;
 
-  ItemMap itemMap_;
-  ItemMap testItemMap_;
+  // positive items of each user
+  ItemSets itemSets_;
+  ItemSets testItemSets_;
+
+  // for the popularity sampler
+  std::unique_ptr<AliasTable> popularityTable_;
+
+  // for the adaptive sampler, factorRankings_[f * nitems() + r] is the item
+  // with the r-th largest factor f, and factorStddevs_[f] is the standard
+  // deviation of factor f across items
+  std::vector<uint32_t> factorRankings_;
+  std::vector<Double> factorStddevs_;
 
   IdIndex userIndex_;
   IdIndex itemIndex_;
@@ -146,13 +484,41 @@ class BPREngine : public Engine {
   std::unique_ptr<FactorData> userFactors_;
   std::unique_ptr<FactorData> itemFactors_;
 
+  // hot items and their slot in the caches (IdIndex::missingIdx if not hot)
+  std::vector<size_t> hotItems_;
+  std::vector<size_t> hotItemSlots_;
+  // one per hogwild thread
+  std::vector<HotItemCache> hotItemCaches_;
+
+  // snapshot of the factors, for the asynchronous evaluation
+  std::unique_ptr<FactorData> evalUserFactors_;
+  std::unique_ptr<FactorData> evalItemFactors_;
+
   std::vector<size_t> testUsers_; // indexes of test users
   std::vector<std::vector<Double>> testLabels_;
   std::vector<std::vector<Double>> testScores_;
+  // for the streaming evaluation
+  std::vector<std::vector<size_t>> testPositives_;
+  std::vector<std::vector<size_t>> testRanks_;
+  // for the sampled evaluation
+  std::vector<std::vector<size_t>> testNegatives_;
+  std::vector<size_t> testNitems_;
 
   // for unit tests
   FRIEND_TEST(BPREngine, init);
   FRIEND_TEST(BPREngine, optimize);
+  FRIEND_TEST(BPREngine, reproducible);
+  FRIEND_TEST(BPREngine, updateBatch);
+  FRIEND_TEST(BPREngine, stratified);
+  FRIEND_TEST(BPREngine, negativeSamplers);
+  FRIEND_TEST(BPREngine, shuffle);
+  FRIEND_TEST(BPREngine, userMajor);
+  FRIEND_TEST(BPREngine, inBatchNegatives);
+  FRIEND_TEST(BPREngine, hotItems);
+  FRIEND_TEST(BPREngine, fusedUpdate);
+  FRIEND_TEST(BPREngine, optimizers);
+  FRIEND_TEST(BPREngine, evalSets);
+  FRIEND_TEST(BPREngine, asyncEvaluation);
 };
 }
 
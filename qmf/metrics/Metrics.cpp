@@ -19,11 +19,61 @@
 #include <algorithm>
 #include <cmath>
 #include <functional>
+#include <limits>
+#include <random>
+
+#include <qmf/utils/Random.h>
 
 #include <glog/logging.h>
 
 namespace qmf {
 
+namespace {
+
+// scores of the positives, in decreasing order
+std::vector<Double> positiveScores(const std::vector<Double>& labels,
+                                   const std::vector<Double>& scores) {
+  std::vector<Double> posScores;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    if (labels[i] > 0.0) {
+      posScores.push_back(scores[i]);
+    }
+  }
+  std::sort(posScores.begin(), posScores.end(), std::greater<Double>());
+  return posScores;
+}
+
+// a negative outranks the positives with a strictly lower score, which are a
+// suffix of posScores: counts[j] gets the number of negatives of [begin, end)
+// whose suffix starts at j
+void countNegatives(std::vector<size_t>& counts,
+                    const std::vector<Double>& posScores,
+                    const std::vector<Double>& labels,
+                    const std::vector<Double>& scores,
+                    const size_t begin,
+                    const size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    if (labels[i] <= 0.0) {
+      const auto it = std::upper_bound(posScores.begin(), posScores.end(),
+                                       scores[i], std::greater<Double>());
+      ++counts[it - posScores.begin()];
+    }
+  }
+}
+
+// ranks of the positives, given the counts of countNegatives
+std::vector<size_t> ranksFromCounts(const std::vector<size_t>& counts) {
+  const size_t npos = counts.size() - 1;
+  std::vector<size_t> ranks(npos);
+  size_t negAbove = 0;
+  for (size_t j = 0; j < npos; ++j) {
+    negAbove += counts[j];
+    ranks[j] = negAbove + j;
+  }
+  return ranks;
+}
+}
+
 Double Metric::compute(const std::vector<std::vector<Double>>& labels,
                        const std::vector<std::vector<Double>>& scores) const {
   CHECK_EQ(labels.size(), scores.size());
@@ -51,6 +101,174 @@ Double Metric::compute(const std::vector<std::vector<Double>>& labels,
   return tot / labels.size();
 }
 
+Double Metric::computeFromRanks(const std::vector<size_t>& /*ranks*/,
+                                const size_t /*nitems*/) const {
+  LOG(FATAL) << "metric can't be computed from ranks";
+  return 0.0;
+}
+
+Double Metric::compute(const std::vector<std::vector<size_t>>& ranks,
+                       const size_t nitems,
+                       ParallelExecutor& parallel) const {
+  CHECK_GT(ranks.size(), 0);
+  const Double tot = parallel.mapReduce(
+    /*numTasks=*/ranks.size(),
+    /*mapper=*/
+    [this, &ranks, nitems](const size_t taskId) {
+      return this->computeFromRanks(ranks[taskId], nitems);
+    },
+    /*reducer=*/std::plus<Double>(),
+    /*neutralElem=*/0.0);
+  return tot / ranks.size();
+}
+
+Double Metric::compute(const std::vector<std::vector<size_t>>& ranks,
+                       const std::vector<size_t>& nitems,
+                       ParallelExecutor& parallel) const {
+  CHECK_EQ(ranks.size(), nitems.size());
+  CHECK_GT(ranks.size(), 0);
+  const Double tot = parallel.mapReduce(
+    /*numTasks=*/ranks.size(),
+    /*mapper=*/
+    [this, &ranks, &nitems](const size_t taskId) {
+      return this->computeFromRanks(ranks[taskId], nitems[taskId]);
+    },
+    /*reducer=*/std::plus<Double>(),
+    /*neutralElem=*/0.0);
+  return tot / ranks.size();
+}
+
+std::vector<size_t> Metric::rankPositives(const std::vector<Double>& labels,
+                                          const std::vector<Double>& scores) {
+  CHECK_EQ(labels.size(), scores.size());
+  const auto posScores = positiveScores(labels, scores);
+  std::vector<size_t> counts(posScores.size() + 1);
+  countNegatives(counts, posScores, labels, scores, 0, labels.size());
+  return ranksFromCounts(counts);
+}
+
+const size_t MetricBundle::splitItems;
+
+std::vector<Double> MetricBundle::compute(
+  const std::vector<Double>& labels,
+  const std::vector<Double>& scores) const {
+  std::vector<Double> res;
+  for (const auto* m : metrics_) {
+    res.push_back(m->compute(labels, scores));
+  }
+  return res;
+}
+
+std::vector<Double> MetricBundle::compute(
+  const std::vector<std::vector<Double>>& labels,
+  const std::vector<std::vector<Double>>& scores) const {
+  std::vector<Double> res;
+  for (const auto* m : metrics_) {
+    res.push_back(m->compute(labels, scores));
+  }
+  return res;
+}
+
+std::vector<Double> MetricBundle::compute(
+  const std::vector<std::vector<Double>>& labels,
+  const std::vector<std::vector<Double>>& scores,
+  ParallelExecutor& parallel) const {
+  std::vector<Double> res(metrics_.size());
+  std::vector<size_t> rankBased;
+  for (size_t j = 0; j < metrics_.size(); ++j) {
+    if (metrics_[j]->rankBased()) {
+      rankBased.push_back(j);
+    } else {
+      res[j] = metrics_[j]->compute(labels, scores, parallel);
+    }
+  }
+  if (rankBased.empty()) {
+    return res;
+  }
+  CHECK_EQ(labels.size(), scores.size());
+  CHECK_GT(labels.size(), 0);
+  const size_t nusers = labels.size();
+
+  std::vector<std::vector<Double>> posScores(nusers);
+  size_t maxItems = 0;
+  for (size_t i = 0; i < nusers; ++i) {
+    CHECK_EQ(labels[i].size(), scores[i].size());
+    maxItems = std::max(maxItems, labels[i].size());
+  }
+  parallel.execute(nusers, [&](const size_t taskId) {
+    posScores[taskId] = positiveScores(labels[taskId], scores[taskId]);
+  });
+
+  // with few users, the items of each user are split into ranges whose
+  // negatives are counted by separate tasks
+  const size_t nsplits =
+    parallel.numSplits(nusers, (maxItems + splitItems - 1) / splitItems);
+  std::vector<std::vector<size_t>> counts(nusers * nsplits);
+  parallel.execute(nusers * nsplits, [&](const size_t taskId) {
+    const size_t user = taskId / nsplits;
+    const size_t split = taskId % nsplits;
+    const size_t n = labels[user].size();
+    counts[taskId].assign(posScores[user].size() + 1, 0);
+    countNegatives(counts[taskId], posScores[user], labels[user],
+                   scores[user], split * n / nsplits,
+                   (split + 1) * n / nsplits);
+  });
+
+  const auto tot = parallel.mapReduce(
+    /*numTasks=*/nusers,
+    /*mapper=*/
+    [this, &labels, &counts, &rankBased, nsplits](const size_t taskId) {
+      auto merged = counts[taskId * nsplits];
+      for (size_t split = 1; split < nsplits; ++split) {
+        const auto& partial = counts[taskId * nsplits + split];
+        for (size_t j = 0; j < merged.size(); ++j) {
+          merged[j] += partial[j];
+        }
+      }
+      const auto ranks = ranksFromCounts(merged);
+      std::vector<Double> vals;
+      for (const size_t j : rankBased) {
+        vals.push_back(
+          metrics_[j]->computeFromRanks(ranks, labels[taskId].size()));
+      }
+      return vals;
+    },
+    /*reducer=*/
+    [](std::vector<Double> a, const std::vector<Double>& b) {
+      for (size_t j = 0; j < a.size(); ++j) {
+        a[j] += b[j];
+      }
+      return a;
+    },
+    /*neutralElem=*/std::vector<Double>(rankBased.size(), 0.0));
+  for (size_t j = 0; j < rankBased.size(); ++j) {
+    res[rankBased[j]] = tot[j] / labels.size();
+  }
+  return res;
+}
+
+std::vector<Double> MetricBundle::compute(
+  const std::vector<std::vector<size_t>>& ranks,
+  const size_t nitems,
+  ParallelExecutor& parallel) const {
+  std::vector<Double> res;
+  for (const auto* m : metrics_) {
+    res.push_back(m->compute(ranks, nitems, parallel));
+  }
+  return res;
+}
+
+std::vector<Double> MetricBundle::compute(
+  const std::vector<std::vector<size_t>>& ranks,
+  const std::vector<size_t>& nitems,
+  ParallelExecutor& parallel) const {
+  std::vector<Double> res;
+  for (const auto* m : metrics_) {
+    res.push_back(m->compute(ranks, nitems, parallel));
+  }
+  return res;
+}
+
 Double MeanSquaredError::compute(const std::vector<Double>& labels,
                                  const std::vector<Double>& scores) const {
   CHECK_EQ(labels.size(), scores.size());
@@ -98,6 +316,94 @@ Double AUC::compute(const std::vector<Double>& labels,
   return auc;
 }
 
+Double AUC::computeFromRanks(const std::vector<size_t>& ranks,
+                            const size_t nitems) const {
+  const size_t pos = ranks.size();
+  const size_t neg = nitems - pos;
+  if (pos == 0 || neg == 0) {
+    LOG(ERROR) << "AUC needs at least 1 example in each class";
+    return 1.0;
+  }
+  // the j-th positive has ranks[j] - j negatives above it
+  Double auc = 0.0;
+  for (size_t j = 0; j < pos; ++j) {
+    auc += static_cast<Double>(neg - (ranks[j] - j)) / pos / neg;
+  }
+  return auc;
+}
+
+const size_t AUCApprox::sampleFactor;
+
+Double AUCApprox::compute(const std::vector<Double>& labels,
+                          const std::vector<Double>& scores) const {
+  CHECK_EQ(labels.size(), scores.size());
+  CHECK_GT(nbuckets_, 0);
+  if (scores.empty()) {
+    LOG(ERROR) << "AUC needs at least 1 example in each class";
+    return 1.0;
+  }
+  // bucket boundaries at the quantiles of a sample of the scores (drawn at
+  // random, so that periodic patterns in the scores don't bias it), so that
+  // buckets hold about as many items each whatever the distribution of the
+  // scores, e.g. with outliers
+  std::vector<Double> sample;
+  if (scores.size() <= sampleFactor * nbuckets_) {
+    sample = scores;
+  } else {
+    sample.resize(sampleFactor * nbuckets_);
+    Xoshiro256 gen; // with a fixed seed, for reproducible results
+    std::uniform_int_distribution<size_t> distr(0, scores.size() - 1);
+    for (auto& s : sample) {
+      s = scores[distr(gen)];
+    }
+  }
+  std::sort(sample.begin(), sample.end());
+  const size_t nsample = sample.size();
+  std::vector<Double> bounds(nbuckets_ - 1);
+  for (size_t b = 1; b < nbuckets_; ++b) {
+    bounds[b - 1] = sample[b * nsample / nbuckets_];
+  }
+
+  std::vector<size_t> posCounts(nbuckets_);
+  std::vector<size_t> negCounts(nbuckets_);
+  // range of the scores of each bucket, to tell apart those of equal scores
+  std::vector<Double> minScores(nbuckets_, std::numeric_limits<Double>::max());
+  std::vector<Double> maxScores(
+    nbuckets_, std::numeric_limits<Double>::lowest());
+  for (size_t i = 0; i < labels.size(); ++i) {
+    // bucket b holds the scores in [bounds[b - 1], bounds[b]), so that equal
+    // scores share a bucket
+    const size_t b =
+      std::upper_bound(bounds.begin(), bounds.end(), scores[i]) -
+      bounds.begin();
+    minScores[b] = std::min(minScores[b], scores[i]);
+    maxScores[b] = std::max(maxScores[b], scores[i]);
+    if (labels[i] > 0.0) {
+      ++posCounts[b];
+    } else {
+      ++negCounts[b];
+    }
+  }
+
+  Double pos = 0.0;
+  Double neg = 0.0;
+  Double auc = 0.0;
+  // from the lowest bucket up, each positive outranks the negatives of the
+  // buckets below and half of those of its own (all of them if their scores
+  // are tied, as in AUC)
+  for (size_t b = 0; b < nbuckets_; ++b) {
+    const Double tied = minScores[b] == maxScores[b] ? 1.0 : 0.5;
+    auc += posCounts[b] * (neg + tied * negCounts[b]);
+    pos += posCounts[b];
+    neg += negCounts[b];
+  }
+  if (pos == 0 || neg == 0) {
+    LOG(ERROR) << "AUC needs at least 1 example in each class";
+    return 1.0;
+  }
+  return auc / pos / neg;
+}
+
 Double Precision::compute(const std::vector<Double>& labels,
                           const std::vector<Double>& scores) const {
   CHECK_EQ(labels.size(), scores.size());
@@ -114,6 +420,14 @@ Double Precision::compute(const std::vector<Double>& labels,
   return static_cast<Double>(pos) / k_;
 }
 
+Double Precision::computeFromRanks(const std::vector<size_t>& ranks,
+                                   const size_t nitems) const {
+  CHECK_GE(nitems, k_) << "P@k needs at least k ranked elements";
+  const auto pos = std::lower_bound(ranks.begin(), ranks.end(), k_) -
+                   ranks.begin();
+  return static_cast<Double>(pos) / k_;
+}
+
 Double Recall::compute(const std::vector<Double>& labels,
                        const std::vector<Double>& scores) const {
   CHECK_EQ(labels.size(), scores.size());
@@ -136,6 +450,15 @@ Double Recall::compute(const std::vector<Double>& labels,
   return static_cast<Double>(pos) / totalPos;
 }
 
+Double Recall::computeFromRanks(const std::vector<size_t>& ranks,
+                                const size_t nitems) const {
+  CHECK_GE(nitems, k_) << "R@k needs at least k ranked elements";
+  CHECK_GT(ranks.size(), 0) << "R@k needs at least 1 positive";
+  const auto pos = std::lower_bound(ranks.begin(), ranks.end(), k_) -
+                   ranks.begin();
+  return static_cast<Double>(pos) / ranks.size();
+}
+
 Double AveragePrecision::compute(const std::vector<Double>& labels,
                                  const std::vector<Double>& scores) const {
   CHECK_EQ(labels.size(), scores.size());
@@ -162,4 +485,14 @@ Double AveragePrecision::compute(const std::vector<Double>& labels,
   }
   return ap / totalPos;
 }
+
+Double AveragePrecision::computeFromRanks(const std::vector<size_t>& ranks,
+                                          const size_t /*nitems*/) const {
+  CHECK_GT(ranks.size(), 0) << "AP needs at least 1 positive";
+  Double ap = 0.0;
+  for (size_t j = 0; j < ranks.size(); ++j) {
+    ap += static_cast<Double>(j + 1) / (ranks[j] + 1);
+  }
+  return ap / ranks.size();
+}
 }
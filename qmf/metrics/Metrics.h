@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <utility>
 #include <vector>
 
 #include <qmf/Types.h>
@@ -36,6 +37,71 @@ class Metric {
   virtual Double compute(const std::vector<std::vector<Double>>& labels,
                          const std::vector<std::vector<Double>>& scores,
                          ParallelExecutor& parallel) const;
+
+  // computes the metric of a user from the (0-based, increasing) positions of
+  // its positives in the ranking of all nitems items by decreasing score,
+  // where positives come first among items with equal scores. fails for
+  // metrics that need the scores themselves
+  virtual Double computeFromRanks(const std::vector<size_t>& ranks,
+                                  const size_t nitems) const;
+
+  // average of computeFromRanks over users
+  Double compute(const std::vector<std::vector<size_t>>& ranks,
+                 const size_t nitems,
+                 ParallelExecutor& parallel) const;
+
+  // same, when the users have different numbers of ranked items
+  Double compute(const std::vector<std::vector<size_t>>& ranks,
+                 const std::vector<size_t>& nitems,
+                 ParallelExecutor& parallel) const;
+
+  // whether computeFromRanks is implemented
+  virtual bool rankBased() const {
+    return false;
+  }
+
+  // the ranks of the positives of labels (see computeFromRanks), found by
+  // only sorting the scores of the positives and searching each negative in
+  // them
+  static std::vector<size_t> rankPositives(const std::vector<Double>& labels,
+                                           const std::vector<Double>& scores);
+};
+
+// computes several metrics at once, with the same arguments as Metric. the
+// average over users of labels and scores ranks the items of each user once
+// for all the rank based metrics, instead of once per metric (and splits the
+// items of each user across tasks when there are few users)
+class MetricBundle {
+ public:
+  explicit MetricBundle(std::vector<const Metric*> metrics)
+    : metrics_(std::move(metrics)) {
+  }
+
+  std::vector<Double> compute(const std::vector<Double>& labels,
+                              const std::vector<Double>& scores) const;
+
+  std::vector<Double> compute(
+    const std::vector<std::vector<Double>>& labels,
+    const std::vector<std::vector<Double>>& scores) const;
+
+  std::vector<Double> compute(
+    const std::vector<std::vector<Double>>& labels,
+    const std::vector<std::vector<Double>>& scores,
+    ParallelExecutor& parallel) const;
+
+  std::vector<Double> compute(const std::vector<std::vector<size_t>>& ranks,
+                              const size_t nitems,
+                              ParallelExecutor& parallel) const;
+
+  std::vector<Double> compute(const std::vector<std::vector<size_t>>& ranks,
+                              const std::vector<size_t>& nitems,
+                              ParallelExecutor& parallel) const;
+
+ private:
+  // minimum number of items of a user counted by a task
+  static const size_t splitItems = 4096;
+
+  std::vector<const Metric*> metrics_;
 };
 
 class MeanSquaredError : public Metric {
@@ -48,6 +114,34 @@ class AUC : public Metric {
  public:
   Double compute(const std::vector<Double>& labels,
                  const std::vector<Double>& scores) const override;
+
+  Double computeFromRanks(const std::vector<size_t>& ranks,
+                          const size_t nitems) const override;
+
+  bool rankBased() const override {
+    return true;
+  }
+};
+
+// approximate AUC in O(nitems * log(nbuckets) + nsample * log(nsample)):
+// scores are assigned to nbuckets buckets, whose boundaries are quantiles of
+// a random sample of nsample = sampleFactor * nbuckets scores, and the
+// (positive, negative) pairs of a same bucket count for 1/2 (or for 1, as in
+// AUC, if all the scores of the bucket are equal). the error is at most half
+// the fraction of pairs of different scores that share a bucket, which is at
+// most the size of the largest bucket divided by nitems
+class AUCApprox : public Metric {
+ public:
+  explicit AUCApprox(const size_t nbuckets = 1024) : nbuckets_(nbuckets) {
+  }
+
+  Double compute(const std::vector<Double>& labels,
+                 const std::vector<Double>& scores) const override;
+
+  static const size_t sampleFactor = 16;
+
+ private:
+  const size_t nbuckets_;
 };
 
 class Precision : public Metric {
@@ -58,6 +152,13 @@ class Precision : public Metric {
   Double compute(const std::vector<Double>& labels,
                  const std::vector<Double>& scores) const override;
 
+  Double computeFromRanks(const std::vector<size_t>& ranks,
+                          const size_t nitems) const override;
+
+  bool rankBased() const override {
+    return true;
+  }
+
  private:
   const size_t k_;  // precision window size
 };
@@ -70,6 +171,13 @@ class Recall : public Metric {
   Double compute(const std::vector<Double>& labels,
                  const std::vector<Double>& scores) const override;
 
+  Double computeFromRanks(const std::vector<size_t>& ranks,
+                          const size_t nitems) const override;
+
+  bool rankBased() const override {
+    return true;
+  }
+
  private:
   const size_t k_;  // recall window size
 };
@@ -79,5 +187,12 @@ class AveragePrecision : public Metric {
  public:
   Double compute(const std::vector<Double>& labels,
                  const std::vector<Double>& scores) const override;
+
+  Double computeFromRanks(const std::vector<size_t>& ranks,
+                          const size_t nitems) const override;
+
+  bool rankBased() const override {
+    return true;
+  }
 };
 }
@@ -22,6 +22,15 @@ MetricsEngine::MetricsEngine(const MetricsConfig& config, const bool log)
   : config_(config), log_(log) {
 }
 
+bool MetricsEngine::addTestAvgMetric(const std::string& metric) {
+  if ((config_.streaming || config_.sampledNegatives > 0) &&
+      MetricsManager::get().exists(metric) &&
+      !MetricsManager::get().getMetric(metric)->rankBased()) {
+    return false;
+  }
+  return addMetric(testAvgMetrics_, metric);
+}
+
 bool MetricsEngine::addMetric(
   std::vector<std::string>& metrics,
   const std::string& metric) {
@@ -36,6 +45,7 @@ bool MetricsEngine::addMetric(
 void MetricsEngine::recordMetric(const std::string& metricKey,
                                  const size_t epoch,
                                  const Double val) {
+  std::lock_guard<std::mutex> lock(mutex_);
   metricsMap_[metricKey].emplace_back(epoch, val);
   if (log_) {
     LOG(INFO) << "epoch " << epoch << ": recorded metric " << metricKey << " = "
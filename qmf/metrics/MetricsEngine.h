@@ -17,7 +17,9 @@
 #pragma once
 
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 #include <unordered_map>
 
@@ -30,6 +32,21 @@ struct MetricsConfig {
   size_t numTestUsers;
   bool alwaysCompute;
   int32_t seed;
+  // compute the test average metrics from the ranks of the positives, which
+  // are found by scoring items by blocks, instead of keeping the labels and
+  // scores of all items for all test users
+  bool streaming = false;
+  // rank the positives of each test user against this many sampled items
+  // that aren't positives (with the seed above) instead of against all items
+  // (0 = disabled). these approximate metrics are recorded with the
+  // "test_sampled_avg_" prefix
+  size_t sampledNegatives = 0;
+  // compute the test average metrics on a snapshot of the factors in the
+  // background, while the next epoch runs
+  bool async = false;
+  // number of threads of the background evaluation, on top of the ones of
+  // the training
+  size_t asyncNthreads = 1;
 };
 
 /**
@@ -56,34 +73,48 @@ class MetricsEngine {
     return addMetric(trainAvgMetrics_, metric);
   }
 
-  bool addTestAvgMetric(const std::string& metric) {
-    return addMetric(testAvgMetrics_, metric);
-  }
+  // fails for metrics that can't be computed from ranks when the
+  // evaluation is streaming or sampled
+  bool addTestAvgMetric(const std::string& metric);
 
   void computeAndRecordTrainMetrics(const size_t epoch,
                                     const std::vector<Double>& labels,
                                     const std::vector<Double>& scores) {
-    computeAndRecordMetrics(trainMetrics_, "train_", epoch, labels, scores);
+    computeAndRecordMetrics(
+      trainMetrics_, "train_", "", epoch, labels, scores);
   }
 
   void computeAndRecordTestMetrics(const size_t epoch,
                                    const std::vector<Double>& labels,
                                    const std::vector<Double>& scores) {
-    computeAndRecordMetrics(testMetrics_, "test_", epoch, labels, scores);
+    computeAndRecordMetrics(testMetrics_, "test_", "", epoch, labels, scores);
   }
 
   template <typename... ComputeArgs>
   void computeAndRecordTrainAvgMetrics(
     const size_t epoch,
     ComputeArgs&... args) {
-    computeAndRecordMetrics(trainAvgMetrics_, "train_avg_", epoch, args...);
+    computeAndRecordMetrics(
+      trainAvgMetrics_, "train_avg_", "", epoch, args...);
   }
 
   template <typename... ComputeArgs>
   void computeAndRecordTestAvgMetrics(
     const size_t epoch,
     ComputeArgs&... args) {
-    computeAndRecordMetrics(testAvgMetrics_, "test_avg_", epoch, args...);
+    computeAndRecordMetrics(
+      testAvgMetrics_, testAvgPrefix(), "", epoch, args...);
+  }
+
+  // same as computeAndRecordTestAvgMetrics, with a tag appended to the metric
+  // keys (e.g. "test_avg_auc(lambda=0.1)") to tell apart several models
+  template <typename... ComputeArgs>
+  void computeAndRecordTaggedTestAvgMetrics(
+    const std::string& tag,
+    const size_t epoch,
+    ComputeArgs&... args) {
+    computeAndRecordMetrics(
+      testAvgMetrics_, testAvgPrefix(), "(" + tag + ")", epoch, args...);
   }
 
   const std::vector<std::string>& trainMetrics() const {
@@ -108,16 +139,27 @@ class MetricsEngine {
   bool addMetric(std::vector<std::string>& metrics,
                  const std::string& metric);
 
+  // sampled metrics are told apart from the exact ones
+  std::string testAvgPrefix() const {
+    return config_.sampledNegatives > 0 ? "test_sampled_avg_" : "test_avg_";
+  }
+
   template <typename... ComputeArgs>
   void computeAndRecordMetrics(std::vector<std::string>& metrics,
                                const std::string& prefix,
+                               const std::string& suffix,
                                const size_t epoch,
                                ComputeArgs&... args) {
+    // the metrics are computed together, so that they can share work
+    std::vector<const Metric*> bundle;
     for (const auto& metric : metrics) {
       const auto& m = MetricsManager::get().getMetric(metric);
       CHECK(m) << "missing metric " << prefix + metric;
-      const Double val = m->compute(args...);
-      recordMetric(prefix + metric, epoch, val);
+      bundle.push_back(m.get());
+    }
+    const auto vals = MetricBundle(std::move(bundle)).compute(args...);
+    for (size_t i = 0; i < metrics.size(); ++i) {
+      recordMetric(prefix + metrics[i] + suffix, epoch, vals[i]);
     }
   }
 
@@ -125,7 +167,8 @@ class MetricsEngine {
                     const size_t epoch,
                     const Double val);
 
-  const MetricsConfig& config_;
+  // a copy, as the default config passed to the constructor is a temporary
+  const MetricsConfig config_;
   const bool log_; // whether to log recorded metrics to stderr
 
   std::vector<std::string> trainMetrics_;
@@ -133,5 +176,7 @@ class MetricsEngine {
   std::vector<std::string> testMetrics_;
   std::vector<std::string> testAvgMetrics_;
   std::unordered_map<std::string, MetricVector> metricsMap_;
+  // metrics may be recorded by an evaluation running in the background
+  std::mutex mutex_;
 };
 }
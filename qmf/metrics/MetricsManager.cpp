@@ -33,6 +33,7 @@ MetricsManager::MetricsManager() {
 void MetricsManager::init() {
   registerMetric<MeanSquaredError>("mse");
   registerMetric<AUC>("auc");
+  registerMetric<AUCApprox>("auc_approx");
   registerMetric<AveragePrecision>("ap");
 }
 
@@ -77,15 +78,18 @@ bool MetricsManager::initFromName(const std::string& name) const {
 const std::unique_ptr<Metric>&
   MetricsManager::getMetric(const std::string& name) const {
   if (exists(name)) {
-    return metrics_[name];
+    std::lock_guard<std::mutex> lock(mutex_);
+    return metrics_.at(name);
   }
   return kNullMetricPtr;
 }
 
 bool MetricsManager::exists(const std::string& name) const {
-  auto it = metrics_.find(name);
-  if (it != metrics_.end()) {
-    return true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (metrics_.count(name) > 0) {
+      return true;
+    }
   }
   return initFromName(name);
 }
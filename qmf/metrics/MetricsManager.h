@@ -17,6 +17,7 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -35,7 +36,9 @@ bool parseAtKMetric(const std::string& name,
 }
 
 /**
- * Singleton class for managing metrics and accessing them by name.
+ * Singleton class for managing metrics and accessing them by name. It is
+ * thread-safe, as @k metrics are registered lazily, e.g. by an evaluation
+ * running in the background.
  */
 class MetricsManager {
  public:
@@ -52,8 +55,9 @@ class MetricsManager {
 
   template <typename MetricT, typename... Args>
   void registerMetric(const std::string& name, Args&&... args) const {
-    metrics_.emplace(
-      name, std::make_unique<MetricT>(std::forward<Args>(args)...));
+    auto metric = std::make_unique<MetricT>(std::forward<Args>(args)...);
+    std::lock_guard<std::mutex> lock(mutex_);
+    metrics_.emplace(name, std::move(metric));
   }
 
   const std::unique_ptr<Metric>& getMetric(const std::string& name) const;
@@ -63,7 +67,10 @@ class MetricsManager {
   static const MetricsManager& get();
 
  private:
+  // registered metrics are never removed, so references to them stay valid
+  // without holding the lock
   mutable std::unordered_map<std::string, std::unique_ptr<Metric>> metrics_;
+  mutable std::mutex mutex_;
 
   static MetricsManager instance_;
 };
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <utility>
+
+#include <qmf/DatasetReader.h>
+#include <qmf/FactorReader.h>
+#include <qmf/Recommender.h>
+#include <qmf/utils/IdIndex.h>
+#include <qmf/utils/ItemSets.h>
+#include <qmf/utils/ParallelExecutor.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+// model input
+DEFINE_string(user_factors, "", "filename of user factors");
+DEFINE_string(item_factors, "", "filename of item factors");
+
+// recommendations
+DEFINE_uint64(k, 10, "number of items to recommend to each user");
+DEFINE_string(users, "", "filename of the ids of the users to recommend to, "
+                         "one per line (empty = all users)");
+DEFINE_string(exclude_dataset, "", "filename of a dataset (e.g. the training "
+                                   "one) whose items aren't recommended again "
+                                   "to their users");
+DEFINE_uint64(batch_users, 65536, "number of users whose recommendations are "
+                                  "computed together before being written");
+
+// settings
+DEFINE_int32(nthreads, 16, "number of threads for parallel execution");
+
+// output
+DEFINE_string(output, "", "filename of the recommendations");
+
+int main(int argc, char** argv) {
+  google::SetUsageMessage("recommend");
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  // make glog to log to stderr
+  FLAGS_logtostderr = 1;
+
+  CHECK(!FLAGS_user_factors.empty() && !FLAGS_item_factors.empty())
+    << "missing factors (use options --{user,item}_factors)";
+  CHECK(!FLAGS_output.empty()) << "missing output filename (use --output)";
+  CHECK_GT(FLAGS_batch_users, 0);
+
+  LOG(INFO) << "loading factors";
+  qmf::IdIndex userIndex;
+  qmf::IdIndex itemIndex;
+  const auto userFactors =
+    qmf::FactorReader(FLAGS_user_factors).readAll(userIndex);
+  // item factors may also have biases
+  const auto itemFactors = qmf::FactorReader(FLAGS_item_factors)
+                             .readAll(itemIndex, userFactors->nfactors());
+
+  qmf::ItemSets seen;
+  if (!FLAGS_exclude_dataset.empty()) {
+    LOG(INFO) << "loading excluded items";
+    std::vector<std::pair<size_t, size_t>> pairs;
+    qmf::DatasetReader reader(FLAGS_exclude_dataset);
+    qmf::DatasetElem elem;
+    while (reader.readOne(elem)) {
+      const size_t uidx = userIndex.idx(elem.userId);
+      const size_t iidx = itemIndex.idx(elem.itemId);
+      if (uidx != qmf::IdIndex::missingIdx &&
+          iidx != qmf::IdIndex::missingIdx) {
+        pairs.emplace_back(uidx, iidx);
+      }
+    }
+    seen = qmf::ItemSets(userIndex.size(), itemIndex.size(), pairs);
+  }
+
+  std::vector<size_t> users;
+  if (FLAGS_users.empty()) {
+    for (size_t uidx = 0; uidx < userIndex.size(); ++uidx) {
+      users.push_back(uidx);
+    }
+  } else {
+    std::ifstream fin(FLAGS_users);
+    CHECK(fin) << "can't open " << FLAGS_users;
+    // users listed several times are only recommended to once, in the order
+    // of their first occurrence
+    std::vector<bool> listed(userIndex.size());
+    size_t nduplicates = 0;
+    int64_t id;
+    while (fin >> id) {
+      const size_t uidx = userIndex.idx(id);
+      if (uidx == qmf::IdIndex::missingIdx) {
+        LOG(WARNING) << "user " << id << " has no factors";
+        continue;
+      }
+      if (listed[uidx]) {
+        ++nduplicates;
+        continue;
+      }
+      listed[uidx] = true;
+      users.push_back(uidx);
+    }
+    if (nduplicates > 0) {
+      LOG(WARNING) << "skipped " << nduplicates << " duplicate users";
+    }
+  }
+
+  LOG(INFO) << "recommending to " << users.size() << " users";
+  qmf::ParallelExecutor parallel(FLAGS_nthreads);
+  const qmf::Recommender recommender(
+    *userFactors, *itemFactors, seen, FLAGS_k);
+  std::ofstream fout(FLAGS_output);
+  CHECK(fout) << "can't open " << FLAGS_output;
+  fout << std::fixed << std::setprecision(9);
+  // users are processed by batches, so that the recommendations of all users
+  // don't need to be kept in memory
+  for (size_t first = 0; first < users.size(); first += FLAGS_batch_users) {
+    const size_t last = std::min<size_t>(first + FLAGS_batch_users,
+                                         users.size());
+    const std::vector<size_t> batch(
+      users.begin() + first, users.begin() + last);
+    const auto recommendations = recommender.recommend(batch, parallel);
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const int64_t userId = userIndex.id(batch[i]);
+      for (const auto& rec : recommendations[i]) {
+        fout << userId << ' ' << itemIndex.id(rec.itemIdx) << ' ' << rec.score
+             << '\n';
+      }
+    }
+  }
+
+  return 0;
+}
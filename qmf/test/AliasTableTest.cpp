@@ -0,0 +1,57 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <vector>
+
+#include <qmf/utils/AliasTable.h>
+#include <qmf/utils/Random.h>
+
+#include <gtest/gtest.h>
+
+TEST(AliasTable, distribution) {
+  const std::vector<qmf::Double> weights = {1.0, 0.0, 3.0, 0.5, 5.5};
+  qmf::AliasTable table(weights);
+  EXPECT_EQ(table.size(), weights.size());
+
+  qmf::Xoshiro256 gen(42);
+  const size_t n = 200000;
+  std::vector<size_t> counts(weights.size());
+  for (size_t i = 0; i < n; ++i) {
+    const size_t idx = table.sample(gen);
+    ASSERT_LT(idx, weights.size());
+    ++counts[idx];
+  }
+  EXPECT_EQ(counts[1], 0);
+  for (size_t i = 0; i < weights.size(); ++i) {
+    EXPECT_NEAR(static_cast<qmf::Double>(counts[i]) / n, weights[i] / 10.0,
+                0.005);
+  }
+}
+
+TEST(AliasTable, single) {
+  qmf::AliasTable table({2.0});
+  qmf::Xoshiro256 gen(1);
+  for (size_t i = 0; i < 10; ++i) {
+    EXPECT_EQ(table.sample(gen), 0);
+  }
+}
+
+TEST(AliasTable, invalid) {
+  EXPECT_DEATH(qmf::AliasTable({}), ".*");
+  EXPECT_DEATH(qmf::AliasTable({0.0, 0.0}), ".*");
+  EXPECT_DEATH(qmf::AliasTable({1.0, -1.0}), ".*");
+}
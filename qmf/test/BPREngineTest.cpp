@@ -14,6 +14,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <set>
+
 #include <qmf/bpr/BPREngine.h>
 
 #include <gtest/gtest.h>
@@ -25,7 +29,7 @@ std::unique_ptr<MetricsEngine> kNullMetricEngine = nullptr;
 }
 
 TEST(BPREngine, init) {
-  BPRConfig config;
+  BPRConfig config{};
   config.nfactors = 30;
   config.initDistributionBound = 0.1;
   BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/2);
@@ -41,46 +45,46 @@ TEST(BPREngine, init) {
   EXPECT_EQ(engine.itemFactors_->nfactors(), 30);
 
   EXPECT_EQ(engine.data_.size(), dataset.size());
-  EXPECT_EQ(engine.itemMap_.size(), engine.nusers());
+  EXPECT_EQ(engine.itemSets_.nusers(), engine.nusers());
 
-  // check id indexes and item map
+  // check id indexes and item sets
   const size_t uidx = engine.userIndex_.idx(3);
-  EXPECT_EQ(engine.itemMap_[uidx].size(), 2);
-  EXPECT_GT(engine.itemMap_[uidx].count(engine.itemIndex_.idx(2)), 0);
-  EXPECT_GT(engine.itemMap_[uidx].count(engine.itemIndex_.idx(4)), 0);
+  EXPECT_EQ(engine.itemSets_.size(uidx), 2);
+  EXPECT_TRUE(engine.itemSets_.contains(uidx, engine.itemIndex_.idx(2)));
+  EXPECT_TRUE(engine.itemSets_.contains(uidx, engine.itemIndex_.idx(4)));
 
   // check eval set
   EXPECT_EQ(engine.evalSet_.size(), 2 * dataset.size());
   for (const auto& triplet : engine.evalSet_) {
     const size_t uidx = triplet.userIdx;
-    EXPECT_GT(engine.itemMap_[uidx].count(triplet.posItemIdx), 0);
-    EXPECT_EQ(engine.itemMap_[uidx].count(triplet.negItemIdx), 0);
+    EXPECT_TRUE(engine.itemSets_.contains(uidx, triplet.posItemIdx));
+    EXPECT_FALSE(engine.itemSets_.contains(uidx, triplet.negItemIdx));
   }
 
   // test dataset
   std::vector<DatasetElem> testDataset = {{5, 4}, {3, 10}, {6, 12}, {8, 13}};
   // only the first 2 examples are valid in the training data
   engine.initTest(testDataset);
-  // training item map shouldn't be affected
-  EXPECT_EQ(engine.itemMap_[uidx].size(), 2);
+  // training item sets shouldn't be affected
+  EXPECT_EQ(engine.itemSets_.size(uidx), 2);
 
-  EXPECT_EQ(engine.testItemMap_.size(), engine.nusers());
-  EXPECT_EQ(engine.testItemMap_[uidx].size(), 1);
-  EXPECT_GT(engine.testItemMap_[uidx].count(engine.itemIndex_.idx(10)), 0);
+  EXPECT_EQ(engine.testItemSets_.nusers(), engine.nusers());
+  EXPECT_EQ(engine.testItemSets_.size(uidx), 1);
+  EXPECT_TRUE(engine.testItemSets_.contains(uidx, engine.itemIndex_.idx(10)));
 
   // check test eval set
   EXPECT_EQ(engine.testEvalSet_.size(), 2 * 2);
   for (const auto& triplet : engine.testEvalSet_) {
     const size_t uidx = triplet.userIdx;
-    EXPECT_GT(engine.testItemMap_[uidx].count(triplet.posItemIdx), 0);
-    EXPECT_EQ(engine.testItemMap_[uidx].count(triplet.negItemIdx), 0);
+    EXPECT_TRUE(engine.testItemSets_.contains(uidx, triplet.posItemIdx));
+    EXPECT_FALSE(engine.testItemSets_.contains(uidx, triplet.negItemIdx));
   }
 }
 
 TEST(BPREngine, optimize) {
   const int logLevel = FLAGS_minloglevel;
   FLAGS_minloglevel = 2;
-  BPRConfig config;
+  BPRConfig config{};
   config.nepochs = 40;
   config.nfactors = 1;
   config.initLearningRate = 0.1;
@@ -155,4 +159,698 @@ TEST(BPREngine, optimize) {
 
   FLAGS_minloglevel = logLevel;
 }
+
+TEST(BPREngine, reproducible) {
+  const int logLevel = FLAGS_minloglevel;
+  FLAGS_minloglevel = 2;
+  BPRConfig config{};
+  config.nepochs = 3;
+  config.nfactors = 4;
+  config.initLearningRate = 0.1;
+  config.decayRate = 0.9;
+  config.initDistributionBound = 0.1;
+  config.numNegativeSamples = 2;
+  config.numHogwildThreads = 1;
+  config.useBiases = true;
+  config.shuffleTrainingSet = true;
+  config.seed = 7;
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1}, {1, 3}, {2, 2}, {3, 1}, {3, 4}, {4, 2}, {4, 5}};
+  BPREngine engine1(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  BPREngine engine2(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  engine1.init(dataset);
+  engine2.init(dataset);
+  engine1.optimize();
+  engine2.optimize();
+
+  for (size_t u = 0; u < engine1.nusers(); ++u) {
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_EQ(engine1.userFactors_->at(u, i), engine2.userFactors_->at(u, i));
+    }
+  }
+  for (size_t v = 0; v < engine1.nitems(); ++v) {
+    EXPECT_EQ(engine1.itemFactors_->biasAt(v), engine2.itemFactors_->biasAt(v));
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_EQ(engine1.itemFactors_->at(v, i), engine2.itemFactors_->at(v, i));
+    }
+  }
+
+  FLAGS_minloglevel = logLevel;
+}
+
+TEST(BPREngine, asyncEvaluation) {
+  const int logLevel = FLAGS_minloglevel;
+  FLAGS_minloglevel = 2;
+  BPRConfig config{};
+  config.nepochs = 3;
+  config.nfactors = 4;
+  config.initLearningRate = 0.1;
+  config.decayRate = 0.9;
+  config.initDistributionBound = 0.1;
+  config.numNegativeSamples = 2;
+  config.numHogwildThreads = 1;
+  config.useBiases = true;
+  config.seed = 7;
+  MetricsConfig syncConfig{};
+  syncConfig.alwaysCompute = true;
+  MetricsConfig asyncConfig = syncConfig;
+  asyncConfig.async = true;
+  asyncConfig.asyncNthreads = 2;
+  const auto syncMetricsEngine =
+    std::make_unique<MetricsEngine>(syncConfig, /*log=*/false);
+  const auto asyncMetricsEngine =
+    std::make_unique<MetricsEngine>(asyncConfig, /*log=*/false);
+  syncMetricsEngine->addTestAvgMetric("auc");
+  asyncMetricsEngine->addTestAvgMetric("auc");
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1}, {1, 3}, {2, 2}, {3, 1}, {3, 4}, {4, 2}, {4, 5}};
+  std::vector<DatasetElem> testDataset = {{1, 2}, {2, 5}, {3, 2}, {4, 1}};
+  BPREngine syncEngine(config, syncMetricsEngine, /*evalNumNeg=*/1,
+                       /*evalSeed=*/42, 2);
+  BPREngine asyncEngine(config, asyncMetricsEngine, /*evalNumNeg=*/1,
+                        /*evalSeed=*/42, 2);
+  for (auto* engine : {&syncEngine, &asyncEngine}) {
+    engine->init(dataset);
+    engine->initTest(testDataset);
+    engine->optimize();
+  }
+
+  // the last evaluation completed, on a snapshot of the final factors
+  EXPECT_TRUE(syncEngine.evalUserFactors_ == nullptr);
+  ASSERT_TRUE(asyncEngine.evalUserFactors_ != nullptr);
+  std::vector<std::vector<Double>> testScores = asyncEngine.testScores_;
+  ParallelExecutor parallel(1);
+  Engine::computeTestScores(testScores, asyncEngine.testUsers_,
+                            *asyncEngine.userFactors_,
+                            *asyncEngine.itemFactors_, parallel);
+  EXPECT_EQ(asyncEngine.testScores_, testScores);
+  // training doesn't depend on the evaluation
+  EXPECT_EQ(asyncEngine.testScores_, syncEngine.testScores_);
+
+  FLAGS_minloglevel = logLevel;
+}
+
+TEST(BPREngine, updateBatch) {
+  BPRConfig config{};
+  config.nfactors = 5;
+  config.initLearningRate = 0.1;
+  config.userLambda = 0.01;
+  config.itemLambda = 0.02;
+  config.biasLambda = 0.03;
+  config.initDistributionBound = 0.5;
+  config.useBiases = true;
+  config.seed = 3;
+
+  std::vector<DatasetElem> dataset = {{1, 1}, {1, 3}, {2, 2}, {3, 1}};
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  BPREngine expected(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  engine.init(dataset);
+  expected.init(dataset);
+
+  // gradients of a batch are all computed before updating
+  const std::vector<BPREngine::PosNegTriplet> batch = {
+    {0, 0, 2}, {0, 1, 2}, {1, 2, 0}, {2, 0, 1}};
+  std::vector<Double> grads(batch.size());
+  for (size_t k = 0; k < batch.size(); ++k) {
+    const auto& t = batch[k];
+    grads[k] = expected.lossDerivative(
+      expected.predictDifference(t.userIdx, t.posItemIdx, t.negItemIdx));
+  }
+  for (size_t k = 0; k < batch.size(); ++k) {
+    expected.update(batch[k], grads[k]);
+  }
+  std::vector<Double> buffer(batch.size());
+  engine.updateBatch(batch, buffer);
+
+  for (size_t u = 0; u < engine.nusers(); ++u) {
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_EQ(engine.userFactors_->at(u, i), expected.userFactors_->at(u, i));
+    }
+  }
+  for (size_t v = 0; v < engine.nitems(); ++v) {
+    EXPECT_EQ(engine.itemFactors_->biasAt(v), expected.itemFactors_->biasAt(v));
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_EQ(engine.itemFactors_->at(v, i), expected.itemFactors_->at(v, i));
+    }
+  }
+}
+
+TEST(BPREngine, stratified) {
+  const int logLevel = FLAGS_minloglevel;
+  FLAGS_minloglevel = 2;
+  BPRConfig config{};
+  config.nepochs = 3;
+  config.nfactors = 4;
+  config.initLearningRate = 0.1;
+  config.decayRate = 0.9;
+  config.initDistributionBound = 0.1;
+  config.numNegativeSamples = 2;
+  config.shuffleTrainingSet = true;
+  config.seed = 11;
+  config.numStrata = 3;
+
+  std::vector<DatasetElem> dataset;
+  for (int64_t u = 0; u < 20; ++u) {
+    for (int64_t i = 1 + u % 3; i < 16; i += 1 + u % 4) {
+      dataset.push_back({u, i});
+    }
+  }
+  // so that no user has all items as positives
+  dataset.push_back({20, 0});
+
+  // each element is in its block
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1, 42, 1);
+  engine.init(dataset);
+  EXPECT_EQ(engine.strataData_.size(), engine.data_.size());
+  EXPECT_EQ(engine.strataOffsets_.size(), 3 * 3 + 1);
+  for (size_t ub = 0; ub < 3; ++ub) {
+    for (size_t ib = 0; ib < 3; ++ib) {
+      const size_t block = ub * 3 + ib;
+      for (size_t k = engine.strataOffsets_[block];
+           k < engine.strataOffsets_[block + 1]; ++k) {
+        const auto& pair = engine.strataData_[k];
+        EXPECT_GE(pair.userIdx, engine.strataBound(ub, engine.nusers()));
+        EXPECT_LT(pair.userIdx, engine.strataBound(ub + 1, engine.nusers()));
+        EXPECT_GE(pair.posItemIdx, engine.strataBound(ib, engine.nitems()));
+        EXPECT_LT(pair.posItemIdx, engine.strataBound(ib + 1, engine.nitems()));
+      }
+    }
+  }
+
+  // negatives are sampled in the range, unless all items are positives
+  Xoshiro256 gen(5);
+  for (size_t u = 0; u < engine.nusers(); ++u) {
+    for (size_t k = 0; k < 10; ++k) {
+      const size_t negIdx = engine.sampleRandomNegativeInRange(u, 2, 6, gen);
+      if (negIdx != IdIndex::missingIdx) {
+        EXPECT_GE(negIdx, 2);
+        EXPECT_LT(negIdx, 6);
+        EXPECT_FALSE(engine.itemSets_.contains(u, negIdx));
+      }
+    }
+  }
+  const size_t uidx = engine.userIndex_.idx(0);
+  EXPECT_EQ(engine.sampleRandomNegativeInRange(uidx, engine.itemIndex_.idx(3),
+                                               engine.itemIndex_.idx(3) + 1,
+                                               gen),
+            IdIndex::missingIdx);
+
+  // results don't depend on the number of threads
+  engine.optimize();
+  BPREngine engine4(config, kNullMetricEngine, /*evalNumNeg=*/1, 42, 4);
+  engine4.init(dataset);
+  engine4.optimize();
+  for (size_t u = 0; u < engine.nusers(); ++u) {
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_EQ(engine.userFactors_->at(u, i), engine4.userFactors_->at(u, i));
+    }
+  }
+  for (size_t v = 0; v < engine.nitems(); ++v) {
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_EQ(engine.itemFactors_->at(v, i), engine4.itemFactors_->at(v, i));
+    }
+  }
+
+  FLAGS_minloglevel = logLevel;
+}
+
+TEST(BPREngine, negativeSamplers) {
+  BPRConfig config{};
+  config.nfactors = 1;
+  config.seed = 5;
+  config.negativeSampler = NegativeSampler::Popularity;
+  config.popularityExponent = 1.0;
+
+  // item 0 is the positive of every user but the last, items 1-19 are only
+  // positives of the last user
+  std::vector<DatasetElem> dataset;
+  for (int64_t u = 0; u < 10; ++u) {
+    dataset.push_back({u, 0});
+  }
+  for (int64_t i = 1; i < 20; ++i) {
+    dataset.push_back({10, i});
+  }
+  dataset.push_back({0, 1});
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  engine.init(dataset);
+
+  Xoshiro256 gen(3);
+  const size_t user = engine.userIndex_.idx(10);
+  const size_t item0 = engine.itemIndex_.idx(0);
+  size_t count0 = 0;
+  const size_t n = 10000;
+  for (size_t k = 0; k < n; ++k) {
+    const size_t negIdx = engine.sampleNegative(user, gen);
+    EXPECT_FALSE(engine.itemSets_.contains(user, negIdx));
+    count0 += negIdx == item0;
+  }
+  // only item 0 is a possible negative
+  EXPECT_EQ(count0, n);
+
+  // the popular item 0 is sampled 10 times more than any other item
+  count0 = 0;
+  for (size_t k = 0; k < n; ++k) {
+    count0 += engine.popularityTable_->sample(gen) == item0;
+  }
+  EXPECT_NEAR(static_cast<Double>(count0) / n, 10.0 / 30.0, 0.02);
+
+  // the negatives of user 1 (whose only positive is item 0) follow the
+  // popularity of its other items: item 1 has 2 positives, items 2-19 have 1
+  const size_t otherUser = engine.userIndex_.idx(1);
+  std::vector<size_t> counts(engine.nitems());
+  for (size_t k = 0; k < n; ++k) {
+    ++counts[engine.sampleNegative(otherUser, gen)];
+  }
+  EXPECT_EQ(counts[item0], 0);
+  for (int64_t i = 1; i < 20; ++i) {
+    const Double expected = (i == 1 ? 2.0 : 1.0) / 20.0;
+    EXPECT_NEAR(static_cast<Double>(counts[engine.itemIndex_.idx(i)]) / n,
+                expected, 0.01);
+  }
+
+  // with a single factor equal to the item index, the adaptive sampler picks
+  // the items with the largest index for positive users factors, the ones with
+  // the smallest index for negative ones
+  config.negativeSampler = NegativeSampler::Adaptive;
+  config.adaptiveRankScale = 0.1;
+  BPREngine adaptiveEngine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  adaptiveEngine.init(dataset);
+  adaptiveEngine.itemFactors_->setFactors(
+    [](size_t idx, size_t) { return static_cast<Double>(idx); });
+  adaptiveEngine.rankItemsByFactor();
+  const size_t nitems = adaptiveEngine.nitems();
+  EXPECT_EQ(adaptiveEngine.factorRankings_[0], nitems - 1);
+  EXPECT_EQ(adaptiveEngine.factorRankings_[nitems - 1], 0);
+  const size_t user1 = adaptiveEngine.userIndex_.idx(1);
+  for (const Double sign : {1.0, -1.0}) {
+    adaptiveEngine.userFactors_->at(user1, 0) = sign;
+    size_t top = 0;
+    for (size_t k = 0; k < n; ++k) {
+      const size_t negIdx = adaptiveEngine.sampleNegative(user1, gen);
+      EXPECT_FALSE(adaptiveEngine.itemSets_.contains(user1, negIdx));
+      const size_t rank = sign > 0.0 ? nitems - 1 - negIdx : negIdx;
+      top += rank < 5;
+    }
+    EXPECT_GT(top, 0.8 * n);
+  }
+}
+
+TEST(BPREngine, shuffle) {
+  BPRConfig config{};
+  config.nfactors = 1;
+  config.seed = 9;
+  config.shuffleTrainingSet = true;
+
+  std::vector<DatasetElem> dataset;
+  for (int64_t u = 0; u < 1000; ++u) {
+    for (int64_t i = 0; i < 100; ++i) {
+      dataset.push_back({u, (u + i) % 200});
+    }
+  }
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/0, 42, 3);
+  engine.init(dataset);
+  const size_t nblocks = engine.blockOrder_.size();
+  EXPECT_EQ(nblocks, (dataset.size() + BPREngine::shuffleBlockSize - 1) /
+                       BPREngine::shuffleBlockSize);
+
+  auto sortedBlock = [&engine](const size_t block) {
+    std::vector<std::pair<size_t, size_t>> elems;
+    for (size_t k = engine.blockStart(block); k < engine.blockStart(block + 1);
+         ++k) {
+      elems.emplace_back(engine.data_[k].userIdx, engine.data_[k].posItemIdx);
+    }
+    std::sort(elems.begin(), elems.end());
+    return elems;
+  };
+  std::vector<std::vector<std::pair<size_t, size_t>>> blocks;
+  for (size_t b = 0; b < nblocks; ++b) {
+    blocks.push_back(sortedBlock(b));
+  }
+  const auto data = engine.data_;
+
+  engine.shuffle();
+  // blocks keep their elements
+  size_t moved = 0;
+  for (size_t k = 0; k < data.size(); ++k) {
+    moved += data[k].userIdx != engine.data_[k].userIdx ||
+             data[k].posItemIdx != engine.data_[k].posItemIdx;
+  }
+  EXPECT_GT(moved, data.size() / 2);
+  for (size_t b = 0; b < nblocks; ++b) {
+    EXPECT_EQ(sortedBlock(b), blocks[b]);
+  }
+  auto blockOrder = engine.blockOrder_;
+  std::sort(blockOrder.begin(), blockOrder.end());
+  for (size_t b = 0; b < nblocks; ++b) {
+    EXPECT_EQ(blockOrder[b], b);
+  }
+
+  // the result doesn't depend on the number of threads
+  BPREngine engine1(config, kNullMetricEngine, /*evalNumNeg=*/0, 42, 1);
+  engine1.init(dataset);
+  engine1.shuffle();
+  EXPECT_EQ(engine1.blockOrder_, engine.blockOrder_);
+  for (size_t k = 0; k < data.size(); ++k) {
+    EXPECT_EQ(engine1.data_[k].userIdx, engine.data_[k].userIdx);
+    EXPECT_EQ(engine1.data_[k].posItemIdx, engine.data_[k].posItemIdx);
+  }
+}
+
+TEST(BPREngine, userMajor) {
+  BPRConfig config{};
+  config.nfactors = 3;
+  config.initLearningRate = 0.1;
+  config.userLambda = 0.01;
+  config.itemLambda = 0.02;
+  config.initDistributionBound = 0.5;
+  config.numNegativeSamples = 3;
+  config.seed = 4;
+  config.userMajor = true;
+
+  // the only possible negative of the user is item 2
+  std::vector<DatasetElem> dataset = {{1, 1}, {2, 2}};
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  BPREngine expected(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  engine.init(dataset);
+  expected.init(dataset);
+  EXPECT_EQ(engine.userOrder_.size(), engine.nusers());
+
+  // the user factors are only written back at the end
+  const size_t uidx = engine.userIndex_.idx(1);
+  const BPREngine::PosNegTriplet triplet{
+    uidx, engine.itemIndex_.idx(1), engine.itemIndex_.idx(2)};
+  for (size_t k = 0; k < config.numNegativeSamples; ++k) {
+    expected.update(triplet);
+  }
+  engine.userOrder_ = {uidx};
+  Xoshiro256 gen(1);
+  engine.runUsers(0, 1, gen);
+  for (size_t i = 0; i < config.nfactors; ++i) {
+    EXPECT_DOUBLE_EQ(engine.userFactors_->at(uidx, i),
+                     expected.userFactors_->at(uidx, i));
+    for (size_t v = 0; v < engine.nitems(); ++v) {
+      EXPECT_DOUBLE_EQ(engine.itemFactors_->at(v, i),
+                       expected.itemFactors_->at(v, i));
+    }
+  }
+}
+
+TEST(BPREngine, inBatchNegatives) {
+  BPRConfig config{};
+  config.nfactors = 4;
+  config.initLearningRate = 0.1;
+  config.userLambda = 0.01;
+  config.itemLambda = 0.02;
+  config.biasLambda = 0.03;
+  config.initDistributionBound = 0.5;
+  config.useBiases = true;
+  config.numNegativeSamples = 2;
+  config.seed = 8;
+  config.negativeSampler = NegativeSampler::InBatch;
+  config.batchSize = 4;
+  config.inBatchPoolSize = 3;
+
+  // each user has a single negative
+  std::vector<DatasetElem> dataset = {{1, 1}, {2, 2}, {3, 1}};
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  BPREngine expected(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  engine.init(dataset);
+  expected.init(dataset);
+
+  std::vector<BPREngine::PosNegTriplet> triplets;
+  for (const auto& p : engine.data_) {
+    for (size_t j = 0; j < config.numNegativeSamples; ++j) {
+      triplets.push_back({p.userIdx, p.posItemIdx, 1 - p.posItemIdx});
+    }
+  }
+  std::vector<Double> grads(triplets.size());
+  expected.updateBatch(triplets, grads);
+  Xoshiro256 gen(2);
+  engine.updateInBatch(engine.data_, gen);
+
+  for (size_t u = 0; u < engine.nusers(); ++u) {
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_NEAR(
+        engine.userFactors_->at(u, i), expected.userFactors_->at(u, i), 1e-12);
+    }
+  }
+  for (size_t v = 0; v < engine.nitems(); ++v) {
+    EXPECT_NEAR(
+      engine.itemFactors_->biasAt(v), expected.itemFactors_->biasAt(v), 1e-12);
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_NEAR(
+        engine.itemFactors_->at(v, i), expected.itemFactors_->at(v, i), 1e-12);
+    }
+  }
+
+  config.batchSize = 1;
+  BPREngine invalid(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  EXPECT_DEATH(invalid.init(dataset), ".*");
+}
+
+TEST(BPREngine, hotItems) {
+  BPRConfig config{};
+  config.nfactors = 4;
+  config.initLearningRate = 0.1;
+  config.userLambda = 0.01;
+  config.itemLambda = 0.02;
+  config.biasLambda = 0.03;
+  config.initDistributionBound = 0.5;
+  config.useBiases = true;
+  config.seed = 9;
+  config.numHotItems = 2;
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1}, {1, 3}, {2, 2}, {2, 3}, {3, 3}, {3, 2}, {4, 4}};
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  BPREngine expected(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  engine.init(dataset);
+  expected.init(dataset);
+
+  const size_t item2 = engine.itemIndex_.idx(2);
+  const size_t item3 = engine.itemIndex_.idx(3);
+  ASSERT_EQ(engine.hotItems_, std::vector<size_t>({item3, item2}));
+  EXPECT_EQ(engine.hotItemSlots_[item3], 0);
+  EXPECT_EQ(engine.hotItemSlots_[item2], 1);
+  EXPECT_EQ(engine.hotItemSlots_[engine.itemIndex_.idx(1)],
+            IdIndex::missingIdx);
+
+  BPREngine::HotItemCache cache;
+  cache.local = std::make_unique<FactorData>(2, config.nfactors, true);
+  cache.base = std::make_unique<FactorData>(2, config.nfactors, true);
+  engine.syncHotItems(cache);
+
+  std::vector<BPREngine::PosNegTriplet> triplets;
+  for (const auto& p : engine.data_) {
+    for (size_t v = 0; v < engine.nitems(); ++v) {
+      if (!engine.itemSets_.contains(p.userIdx, v)) {
+        triplets.push_back({p.userIdx, p.posItemIdx, v});
+      }
+    }
+  }
+  for (const auto& triplet : triplets) {
+    engine.update(triplet, &cache);
+    expected.update(triplet);
+  }
+  // the shared hot rows only change when merging
+  EXPECT_NE(engine.itemFactors_->at(item3, 0),
+            expected.itemFactors_->at(item3, 0));
+  engine.syncHotItems(cache);
+
+  // with a single thread, the updates are the same as without copies
+  for (size_t u = 0; u < engine.nusers(); ++u) {
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_NEAR(
+        engine.userFactors_->at(u, i), expected.userFactors_->at(u, i), 1e-12);
+    }
+  }
+  for (size_t v = 0; v < engine.nitems(); ++v) {
+    EXPECT_NEAR(
+      engine.itemFactors_->biasAt(v), expected.itemFactors_->biasAt(v), 1e-12);
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_NEAR(
+        engine.itemFactors_->at(v, i), expected.itemFactors_->at(v, i), 1e-12);
+    }
+  }
+  EXPECT_EQ(cache.sinceSync, 0);
+  EXPECT_EQ(cache.local->at(0, 0), engine.itemFactors_->at(item3, 0));
+  EXPECT_EQ(cache.base->at(1, 2), engine.itemFactors_->at(item2, 2));
+}
+
+TEST(BPREngine, fusedUpdate) {
+  BPRConfig config{};
+  config.nfactors = 8;
+  config.initLearningRate = 0.1;
+  config.userLambda = 0.01;
+  config.itemLambda = 0.02;
+  config.biasLambda = 0.03;
+  config.initDistributionBound = 0.5;
+  config.useBiases = true;
+  config.seed = 10;
+
+  std::vector<DatasetElem> dataset = {{1, 1}, {2, 2}, {1, 3}};
+  BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+  engine.init(dataset);
+  const size_t n = config.nfactors;
+  auto copyRow = [n](const Double* row) {
+    return std::vector<Double>(row, row + n);
+  };
+  const size_t pidx = engine.itemIndex_.idx(1);
+  const size_t nidx = engine.itemIndex_.idx(2);
+  std::vector<Double> pu = copyRow(engine.userFactors_->row(0));
+  std::vector<Double> qi = copyRow(engine.itemFactors_->row(pidx));
+  std::vector<Double> qj = copyRow(engine.itemFactors_->row(nidx));
+  Double bi = engine.itemFactors_->biasAt(pidx);
+  Double bj = engine.itemFactors_->biasAt(nidx);
+
+  // the kernel specialized for 8 factors and the generic one agree
+  auto pu0 = pu, qi0 = qi, qj0 = qj;
+  Double bi0 = bi, bj0 = bj;
+  engine.fusedUpdate<8, Optimizer::SGD>(
+    {pu.data(), qi.data(), qj.data(), &bi, &bj, nullptr, nullptr, nullptr});
+  engine.fusedUpdate<0, Optimizer::SGD>({pu0.data(), qi0.data(), qj0.data(),
+                                         &bi0, &bj0, nullptr, nullptr,
+                                         nullptr});
+  EXPECT_EQ(pu, pu0);
+  EXPECT_EQ(qi, qi0);
+  EXPECT_EQ(qj, qj0);
+  EXPECT_EQ(bi, bi0);
+  EXPECT_EQ(bj, bj0);
+
+  // and match an update with the loss derivative computed separately
+  const size_t uidx = 0;
+  const Double e =
+    engine.lossDerivative(engine.predictDifference(uidx, pidx, nidx));
+  engine.update(uidx, engine.userFactors_->row(uidx), pidx, nidx, e);
+  for (size_t i = 0; i < n; ++i) {
+    EXPECT_NEAR(engine.userFactors_->at(0, i), pu[i], 1e-12);
+    EXPECT_NEAR(engine.itemFactors_->at(pidx, i), qi[i], 1e-12);
+    EXPECT_NEAR(engine.itemFactors_->at(nidx, i), qj[i], 1e-12);
+  }
+  EXPECT_NEAR(engine.itemFactors_->biasAt(pidx), bi, 1e-12);
+  EXPECT_NEAR(engine.itemFactors_->biasAt(nidx), bj, 1e-12);
+
+  // non-finite gradients are only reported when checked
+  engine.checkGradients();
+  engine.flagNonFinite(std::nan(""));
+  EXPECT_DEATH(engine.checkGradients(), ".*");
+}
+
+TEST(BPREngine, optimizers) {
+  for (const auto optimizer : {Optimizer::Adagrad, Optimizer::Adam}) {
+    BPRConfig config{};
+    config.nfactors = 3;
+    config.initLearningRate = 0.1;
+    config.userLambda = 0.01;
+    config.itemLambda = 0.02;
+    config.biasLambda = 0.03;
+    config.initDistributionBound = 0.5;
+    config.useBiases = true;
+    config.seed = 11;
+    config.optimizer = optimizer;
+    config.adamBeta1 = 0.8;
+    config.adamBeta2 = 0.9;
+    config.optimizerEpsilon = 1e-6;
+
+    std::vector<DatasetElem> dataset = {{1, 1}, {2, 2}, {1, 3}};
+    BPREngine engine(config, kNullMetricEngine, /*evalNumNeg=*/1);
+    engine.init(dataset);
+    const size_t n = config.nfactors;
+    const size_t stride = optimizer == Optimizer::Adam ? 2 * (n + 1) : n + 1;
+    ASSERT_EQ(engine.stateStride_, stride);
+    ASSERT_EQ(engine.userState_.size(), engine.nusers() * stride);
+    ASSERT_EQ(engine.itemState_.size(), engine.nitems() * stride);
+
+    // step of a parameter with gradient g and accumulators m and v
+    auto step = [&config, optimizer](const Double g, Double& m, Double& v) {
+      if (optimizer == Optimizer::Adagrad) {
+        m += g * g;
+        return config.initLearningRate * g / (std::sqrt(m) + 1e-6);
+      }
+      m = 0.8 * m + 0.2 * g;
+      v = 0.9 * v + 0.1 * g * g;
+      return config.initLearningRate * m / (std::sqrt(v) + 1e-6);
+    };
+
+    const size_t uidx = 0;
+    const size_t pidx = engine.itemIndex_.idx(1);
+    const size_t nidx = engine.itemIndex_.idx(2);
+    const Double e = 0.25;
+    Double pu = engine.userFactors_->at(uidx, 0);
+    Double bi = engine.itemFactors_->biasAt(pidx);
+    Double mu = 0.0, vu = 0.0, mb = 0.0, vb = 0.0;
+    for (size_t t = 0; t < 2; ++t) {
+      const Double gu = e * (engine.itemFactors_->at(pidx, 0) -
+                             engine.itemFactors_->at(nidx, 0)) -
+                        config.userLambda * pu;
+      const Double gb = e - config.biasLambda * bi;
+      pu += step(gu, mu, vu);
+      bi += step(gb, mb, vb);
+      engine.update(uidx, engine.userFactors_->row(uidx), pidx, nidx, e);
+      EXPECT_NEAR(engine.userFactors_->at(uidx, 0), pu, 1e-6);
+      EXPECT_NEAR(engine.itemFactors_->biasAt(pidx), bi, 1e-6);
+    }
+    EXPECT_NEAR(engine.userState_[uidx * stride], mu, 1e-6);
+    EXPECT_NEAR(engine.itemState_[pidx * stride + n], mb, 1e-6);
+    if (optimizer == Optimizer::Adam) {
+      EXPECT_NEAR(engine.userState_[uidx * stride + n + 1], vu, 1e-6);
+      EXPECT_NEAR(engine.itemState_[pidx * stride + 2 * n + 1], vb, 1e-6);
+    }
+    // items that were not updated keep an empty state
+    EXPECT_EQ(engine.itemState_[engine.itemIndex_.idx(3) * stride], 0.0f);
+  }
+}
+
+TEST(BPREngine, evalSets) {
+  BPRConfig config{};
+  config.nfactors = 2;
+  config.initDistributionBound = 0.1;
+  config.seed = 12;
+
+  std::vector<DatasetElem> dataset;
+  for (int64_t user = 0; user < 50; ++user) {
+    for (int64_t item = 0; item < 20; item += 1 + user % 3) {
+      dataset.push_back({user, item});
+    }
+  }
+  dataset.push_back({50, 20});
+
+  // without a limit, all the positives are used, with the same set for any
+  // number of threads
+  BPREngine engine1(config, kNullMetricEngine, /*evalNumNeg=*/2, 42, 1);
+  BPREngine engine4(config, kNullMetricEngine, /*evalNumNeg=*/2, 42, 4);
+  engine1.init(dataset);
+  engine4.init(dataset);
+  ASSERT_EQ(engine1.evalSet_.size(), 2 * engine1.data_.size());
+  ASSERT_EQ(engine4.evalSet_.size(), engine1.evalSet_.size());
+  for (size_t k = 0; k < engine1.evalSet_.size(); ++k) {
+    const auto& t = engine1.evalSet_[k];
+    EXPECT_EQ(t.userIdx, engine1.data_[k / 2].userIdx);
+    EXPECT_EQ(t.posItemIdx, engine1.data_[k / 2].posItemIdx);
+    EXPECT_FALSE(engine1.itemSets_.contains(t.userIdx, t.negItemIdx));
+    EXPECT_EQ(t.negItemIdx, engine4.evalSet_[k].negItemIdx);
+  }
+
+  // with a limit, the positives are sampled without replacement
+  config.evalMaxTriplets = 101;
+  BPREngine limited(config, kNullMetricEngine, /*evalNumNeg=*/2, 42, 4);
+  limited.init(dataset);
+  ASSERT_EQ(limited.evalSet_.size(), 100);
+  std::set<std::pair<size_t, size_t>> positives;
+  for (size_t k = 0; k < limited.evalSet_.size(); k += 2) {
+    const auto& t = limited.evalSet_[k];
+    EXPECT_EQ(t.userIdx, limited.evalSet_[k + 1].userIdx);
+    EXPECT_EQ(t.posItemIdx, limited.evalSet_[k + 1].posItemIdx);
+    EXPECT_TRUE(limited.itemSets_.contains(t.userIdx, t.posItemIdx));
+    EXPECT_FALSE(limited.itemSets_.contains(t.userIdx, t.negItemIdx));
+    positives.emplace(t.userIdx, t.posItemIdx);
+  }
+  EXPECT_EQ(positives.size(), 50);
+
+  // the test set is limited as well
+  limited.initTest(dataset);
+  EXPECT_EQ(limited.testEvalSet_.size(), 100);
+}
 }
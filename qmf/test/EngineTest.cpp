@@ -14,6 +14,14 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <set>
+#include <thread>
+#include <utility>
+
 #include <qmf/Engine.h>
 
 #include <gtest/gtest.h>
@@ -110,6 +118,213 @@ TEST(Engine, computeTestScores) {
   }
 }
 
+TEST(Engine, initSparseTestData) {
+  IdIndex userIndex;
+  IdIndex itemIndex;
+  userIndex.getOrSetIdx(1);
+  userIndex.getOrSetIdx(2);
+  userIndex.getOrSetIdx(3);
+  itemIndex.getOrSetIdx(1);
+  itemIndex.getOrSetIdx(2);
+  itemIndex.getOrSetIdx(4);
+  itemIndex.getOrSetIdx(3);
+
+  // {4, 2} and {1, 5} are invalid, {2, 3} is not a positive
+  std::vector<DatasetElem> testDataset = {
+    {1, 4}, {2, 1}, {4, 2}, {1, 5}, {1, 2}, {1, 4}, {2, 3, 0.0}};
+
+  std::vector<size_t> testUsers;
+  std::vector<std::vector<size_t>> testPositives;
+  Engine::initSparseTestData(
+    testUsers, testPositives, testDataset, userIndex, itemIndex);
+
+  ASSERT_EQ(testUsers.size(), 2);
+  ASSERT_EQ(testPositives.size(), 2);
+  for (size_t i = 0; i < testUsers.size(); ++i) {
+    if (testUsers[i] == userIndex.idx(1)) {
+      EXPECT_EQ(testPositives[i], std::vector<size_t>({1, 2}));
+    } else {
+      EXPECT_EQ(testUsers[i], userIndex.idx(2));
+      EXPECT_EQ(testPositives[i], std::vector<size_t>({0}));
+    }
+  }
+}
+
+TEST(Engine, computeTestRanks) {
+  const size_t nfactors = 2;
+  const size_t nusers = 3;
+  // more items than a block
+  const size_t nitems = Engine::rankBlockSize + 100;
+  FactorData userFactors(nusers, nfactors);
+  FactorData itemFactors(nitems, nfactors, /*useBiases=*/true);
+  // small integer factors, to have ties
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> distr(-3, 3);
+  auto setter = [&distr, &gen](auto...) { return distr(gen); };
+  userFactors.setFactors(setter);
+  itemFactors.setFactors(setter);
+  itemFactors.setBiases(setter);
+
+  const std::vector<size_t> testUsers = {2, 0, 1};
+  const std::vector<std::vector<size_t>> testPositives = {
+    {0, 5, 4100, nitems - 1}, {}, {7}};
+  std::vector<std::vector<Double>> testScores(
+    testUsers.size(), std::vector<Double>(nitems));
+  ParallelExecutor parallel(2);
+  Engine::computeTestScores(
+    testScores, testUsers, userFactors, itemFactors, parallel);
+  std::vector<std::vector<size_t>> testRanks;
+  Engine::computeTestRanks(
+    testRanks, testUsers, testPositives, userFactors, itemFactors, parallel);
+
+  ASSERT_EQ(testRanks.size(), testUsers.size());
+  for (size_t i = 0; i < testUsers.size(); ++i) {
+    // the item tiles of the few users are split across tasks
+    for (size_t idx = 0; idx < nitems; ++idx) {
+      Double expected = itemFactors.biasAt(idx);
+      for (size_t f = 0; f < nfactors; ++f) {
+        expected += userFactors.at(testUsers[i], f) * itemFactors.at(idx, f);
+      }
+      ASSERT_EQ(testScores[i][idx], expected);
+    }
+
+    // positions when sorting by decreasing (score, label)
+    std::vector<std::pair<Double, bool>> scored;
+    for (size_t idx = 0; idx < nitems; ++idx) {
+      const bool positive =
+        std::binary_search(testPositives[i].begin(), testPositives[i].end(),
+                           idx);
+      scored.emplace_back(testScores[i][idx], positive);
+    }
+    std::sort(scored.begin(), scored.end(),
+              std::greater<std::pair<Double, bool>>());
+    std::vector<size_t> expected;
+    for (size_t r = 0; r < nitems; ++r) {
+      if (scored[r].second) {
+        expected.push_back(r);
+      }
+    }
+    EXPECT_EQ(testRanks[i], expected);
+  }
+}
+
+TEST(Engine, sampleTestNegatives) {
+  const size_t nitems = 10;
+  std::vector<std::vector<size_t>> testPositives = {
+    {0, 1, 5}, {}, {0, 1, 2, 3, 4, 5, 6, 8}};
+  for (size_t i = 0; i < 50; ++i) {
+    testPositives.push_back({0, 1, 5});
+  }
+  ParallelExecutor parallel1(1);
+  ParallelExecutor parallel4(4);
+  std::vector<std::vector<size_t>> testNegatives;
+  Engine::sampleTestNegatives(
+    testNegatives, testPositives, nitems, 4, /*seed=*/3, parallel4);
+
+  ASSERT_EQ(testNegatives.size(), testPositives.size());
+  std::set<size_t> sampled;
+  for (size_t i = 0; i < testPositives.size(); ++i) {
+    const auto& negatives = testNegatives[i];
+    EXPECT_TRUE(std::is_sorted(negatives.begin(), negatives.end()));
+    EXPECT_EQ(std::adjacent_find(negatives.begin(), negatives.end()),
+              negatives.end());
+    for (const size_t idx : negatives) {
+      EXPECT_LT(idx, nitems);
+      EXPECT_FALSE(std::binary_search(
+        testPositives[i].begin(), testPositives[i].end(), idx));
+    }
+    if (i == 2) {
+      // fewer items than asked for
+      EXPECT_EQ(negatives, std::vector<size_t>({7, 9}));
+    } else {
+      EXPECT_EQ(negatives.size(), 4);
+    }
+    if (i >= 3) {
+      sampled.insert(negatives.begin(), negatives.end());
+    }
+  }
+  // all the candidates get sampled
+  EXPECT_EQ(sampled, std::set<size_t>({2, 3, 4, 6, 7, 8, 9}));
+
+  // the samples don't depend on the number of threads
+  std::vector<std::vector<size_t>> testNegatives1;
+  Engine::sampleTestNegatives(
+    testNegatives1, testPositives, nitems, 4, /*seed=*/3, parallel1);
+  EXPECT_EQ(testNegatives1, testNegatives);
+}
+
+TEST(Engine, computeSampledTestRanks) {
+  const size_t nfactors = 2;
+  const size_t nusers = 3;
+  const size_t nitems = 200;
+  FactorData userFactors(nusers, nfactors);
+  FactorData itemFactors(nitems, nfactors, /*useBiases=*/true);
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> distr(-3, 3);
+  auto setter = [&distr, &gen](auto...) { return distr(gen); };
+  userFactors.setFactors(setter);
+  itemFactors.setFactors(setter);
+  itemFactors.setBiases(setter);
+
+  const std::vector<size_t> testUsers = {2, 0, 1};
+  const std::vector<std::vector<size_t>> testPositives = {
+    {0, 5, 100, nitems - 1}, {}, {7}};
+  ParallelExecutor parallel(2);
+
+  // with all the other items as negatives, the ranks are the exact ones
+  std::vector<std::vector<size_t>> testNegatives;
+  Engine::sampleTestNegatives(
+    testNegatives, testPositives, nitems, nitems, /*seed=*/0, parallel);
+  std::vector<std::vector<size_t>> testRanks;
+  std::vector<size_t> testNitems;
+  Engine::computeSampledTestRanks(testRanks, testNitems, testUsers,
+                                  testPositives, testNegatives, userFactors,
+                                  itemFactors, parallel);
+  std::vector<std::vector<size_t>> expectedRanks;
+  Engine::computeTestRanks(expectedRanks, testUsers, testPositives,
+                           userFactors, itemFactors, parallel);
+  EXPECT_EQ(testRanks, expectedRanks);
+  EXPECT_EQ(testNitems, std::vector<size_t>(testUsers.size(), nitems));
+
+  // with sampled negatives, each positive is ranked among fewer items
+  Engine::sampleTestNegatives(
+    testNegatives, testPositives, nitems, 20, /*seed=*/0, parallel);
+  Engine::computeSampledTestRanks(testRanks, testNitems, testUsers,
+                                  testPositives, testNegatives, userFactors,
+                                  itemFactors, parallel);
+  for (size_t i = 0; i < testUsers.size(); ++i) {
+    EXPECT_EQ(testNitems[i], testPositives[i].size() + 20);
+    ASSERT_EQ(testRanks[i].size(), testPositives[i].size());
+    for (size_t j = 0; j < testRanks[i].size(); ++j) {
+      EXPECT_GE(testRanks[i][j], j);
+      EXPECT_LE(testRanks[i][j], expectedRanks[i][j]);
+      EXPECT_LT(testRanks[i][j], testNitems[i]);
+    }
+  }
+}
+
+TEST(Engine, evaluateAsync) {
+  Engine engine;
+  std::vector<size_t> order;
+  std::vector<size_t> counts(2);
+  for (size_t i = 0; i < 2; ++i) {
+    engine.evaluateAsync(
+      /*nthreads=*/3, [i, &order, &counts](ParallelExecutor& parallel) {
+        EXPECT_EQ(parallel.nthreads(), 3);
+        // the first evaluation is the slowest, but completes first
+        std::this_thread::sleep_for(std::chrono::milliseconds(50 - 40 * i));
+        order.push_back(i);
+        counts[i] = parallel.mapReduce(
+          10, [](size_t) { return 1; }, std::plus<size_t>(), size_t(0));
+      });
+  }
+  engine.waitForEvaluation();
+  EXPECT_EQ(order, std::vector<size_t>({0, 1}));
+  EXPECT_EQ(counts, std::vector<size_t>({10, 10}));
+  // nothing to wait for
+  engine.waitForEvaluation();
+}
+
 TEST(Engine, saveFactors) {
   const size_t nitems = 2;
   const size_t nfactors = 3;
@@ -61,3 +61,24 @@ TEST(FactorData, noBiases) {
   EXPECT_DEATH(
     fd.biasAt(0) = 1.0, ".*withBiases = false");
 }
+
+TEST(FactorData, copyFrom) {
+  qmf::FactorData fd(3, 2, /*withBiases=*/true);
+  fd.setFactors([](size_t i, size_t j) { return i * 2 + j; });
+  fd.setBiases([](size_t i) { return -1.0 * i; });
+
+  qmf::FactorData copy(3, 2, /*withBiases=*/true);
+  const double* data = copy.row(0);
+  copy.copyFrom(fd);
+  // the memory is reused
+  EXPECT_EQ(copy.row(0), data);
+  for (size_t i = 0; i < 3; ++i) {
+    EXPECT_EQ(copy.biasAt(i), fd.biasAt(i));
+    for (size_t j = 0; j < 2; ++j) {
+      EXPECT_EQ(copy.at(i, j), fd.at(i, j));
+    }
+  }
+
+  qmf::FactorData other(2, 2, /*withBiases=*/true);
+  EXPECT_DEATH(other.copyFrom(fd), ".*");
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sstream>
+
+#include <qmf/FactorReader.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+TEST(FactorReader, readAll) {
+  FactorReader reader;
+  reader.stream_ = std::make_unique<std::istringstream>(
+    "3 0.5 1.5\n"
+    "7 -1 2e-3 \n");
+  IdIndex index;
+  const auto factors = reader.readAll(index);
+  EXPECT_EQ(index.size(), 2);
+  EXPECT_EQ(index.idx(3), 0);
+  EXPECT_EQ(index.idx(7), 1);
+  EXPECT_EQ(factors->nelems(), 2);
+  EXPECT_EQ(factors->nfactors(), 2);
+  EXPECT_FALSE(factors->withBiases());
+  EXPECT_DOUBLE_EQ(factors->at(0, 0), 0.5);
+  EXPECT_DOUBLE_EQ(factors->at(0, 1), 1.5);
+  EXPECT_DOUBLE_EQ(factors->at(1, 0), -1.0);
+  EXPECT_DOUBLE_EQ(factors->at(1, 1), 2e-3);
+}
+
+TEST(FactorReader, readAllWithBiases) {
+  FactorReader reader;
+  // as written by saveFactors for BPR items with biases
+  reader.stream_ = std::make_unique<std::istringstream>(
+    "5 0.250000000 1.000000000 2.000000000\n"
+    "2 -0.500000000 3.000000000 4.000000000\n");
+  IdIndex index;
+  const auto factors = reader.readAll(index, /*nfactors=*/2);
+  EXPECT_EQ(index.idx(5), 0);
+  EXPECT_EQ(index.idx(2), 1);
+  EXPECT_TRUE(factors->withBiases());
+  EXPECT_DOUBLE_EQ(factors->biasAt(0), 0.25);
+  EXPECT_DOUBLE_EQ(factors->biasAt(1), -0.5);
+  EXPECT_DOUBLE_EQ(factors->at(0, 1), 2.0);
+  EXPECT_DOUBLE_EQ(factors->at(1, 0), 3.0);
+}
+
+TEST(FactorReader, readAllBadFormat) {
+  {
+    // inconsistent number of values
+    FactorReader reader;
+    reader.stream_ = std::make_unique<std::istringstream>("1 2 3\n2 4\n");
+    IdIndex index;
+    EXPECT_DEATH(reader.readAll(index), ".*");
+  }
+  {
+    // not a number
+    FactorReader reader;
+    reader.stream_ = std::make_unique<std::istringstream>("1 2 x\n");
+    IdIndex index;
+    EXPECT_DEATH(reader.readAll(index), ".*");
+  }
+  {
+    // wrong number of factors
+    FactorReader reader;
+    reader.stream_ = std::make_unique<std::istringstream>("1 2 3 4\n");
+    IdIndex index;
+    EXPECT_DEATH(reader.readAll(index, /*nfactors=*/1), ".*");
+  }
+  {
+    // duplicate id
+    FactorReader reader;
+    reader.stream_ = std::make_unique<std::istringstream>("1 2\n1 3\n");
+    IdIndex index;
+    EXPECT_DEATH(reader.readAll(index), ".*");
+  }
+}
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <cmath>
+#include <limits>
+
+#include <qmf/utils/FastSigmoid.h>
+
+#include <gtest/gtest.h>
+
+TEST(FastSigmoid, approximation) {
+  qmf::FastSigmoid sigmoid;
+  for (qmf::Double x = -20.0; x <= 20.0; x += 0.0137) {
+    EXPECT_NEAR(sigmoid(x), 1.0 / (1.0 + std::exp(-x)), 1e-5);
+  }
+  EXPECT_EQ(sigmoid(16.0), 1.0);
+  EXPECT_EQ(sigmoid(-16.0), 0.0);
+  EXPECT_EQ(sigmoid(std::numeric_limits<qmf::Double>::infinity()), 1.0);
+  EXPECT_EQ(sigmoid(-std::numeric_limits<qmf::Double>::infinity()), 0.0);
+  EXPECT_TRUE(std::isnan(sigmoid(std::nan(""))));
+  // largest value below the bound
+  EXPECT_NEAR(sigmoid(std::nextafter(16.0, 0.0)), 1.0, 1e-6);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <vector>
+
+#include <qmf/utils/Gemm.h>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+template <typename ScalarT>
+void checkGemm(const size_t m, const size_t n, const size_t k) {
+  // strided rows, to check that the strides are honored
+  const size_t lda = k + 1;
+  const size_t ldb = k + 2;
+  const size_t ldc = n + 3;
+  std::vector<ScalarT> A(m * lda);
+  std::vector<ScalarT> B(n * ldb);
+  for (size_t i = 0; i < A.size(); ++i) {
+    A[i] = static_cast<ScalarT>(i % 7) - 3;
+  }
+  for (size_t i = 0; i < B.size(); ++i) {
+    B[i] = static_cast<ScalarT>(i % 5) - 2;
+  }
+  std::vector<qmf::Double> C(m * ldc, -1.0);
+  qmf::gemm(m, n, k, A.data(), lda, B.data(), ldb, C.data(), ldc);
+  for (size_t i = 0; i < m; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      qmf::Double expected = 0.0;
+      for (size_t p = 0; p < k; ++p) {
+        expected += static_cast<qmf::Double>(A[i * lda + p]) * B[j * ldb + p];
+      }
+      EXPECT_DOUBLE_EQ(C[i * ldc + j], expected);
+    }
+    // padding of C is left untouched
+    for (size_t j = n; j < ldc; ++j) {
+      EXPECT_DOUBLE_EQ(C[i * ldc + j], -1.0);
+    }
+  }
+}
+}
+
+TEST(Gemm, doubleScalars) {
+  // full blocks, edges in each dimension, and several tiles of B
+  checkGemm<qmf::Double>(8, 8, 5);
+  checkGemm<qmf::Double>(7, 10, 3);
+  checkGemm<qmf::Double>(1, 1, 1);
+  checkGemm<qmf::Double>(9, 300, 17);
+}
+
+TEST(Gemm, floatScalars) {
+  checkGemm<float>(8, 8, 5);
+  checkGemm<float>(6, 131, 33);
+}
+
+TEST(Gemm, empty) {
+  std::vector<qmf::Double> A(4, 1.0);
+  std::vector<qmf::Double> C(4, -1.0);
+  // an empty inner dimension gives zeros
+  qmf::gemm(2, 2, 0, A.data(), 0, A.data(), 0, C.data(), 2);
+  for (const auto c : C) {
+    EXPECT_DOUBLE_EQ(c, 0.0);
+  }
+  // nothing to compute
+  qmf::gemm(0, 2, 2, A.data(), 2, A.data(), 2, C.data(), 2);
+}
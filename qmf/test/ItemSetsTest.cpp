@@ -0,0 +1,72 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <qmf/utils/ItemSets.h>
+
+#include <gtest/gtest.h>
+
+TEST(ItemSets, basic) {
+  // user 1 has no items, user 2 has enough items to get a bitmap
+  const std::vector<std::pair<size_t, size_t>> pairs = {
+    {0, 5}, {2, 3}, {0, 1}, {0, 5}, {3, 0}, {2, 7}, {0, 9}};
+  qmf::ItemSets sets(4, 10, pairs);
+  EXPECT_EQ(sets.nusers(), 4);
+  EXPECT_EQ(sets.size(0), 3);
+  EXPECT_EQ(sets.size(1), 0);
+  EXPECT_EQ(sets.size(2), 2);
+  EXPECT_EQ(sets.size(3), 1);
+  EXPECT_EQ(std::vector<uint32_t>(sets.begin(0), sets.end(0)),
+            std::vector<uint32_t>({1, 5, 9}));
+
+  for (size_t i = 0; i < 10; ++i) {
+    EXPECT_EQ(sets.contains(0, i), i == 1 || i == 5 || i == 9);
+    EXPECT_FALSE(sets.contains(1, i));
+    EXPECT_EQ(sets.contains(2, i), i == 3 || i == 7);
+    EXPECT_EQ(sets.contains(3, i), i == 0);
+  }
+}
+
+TEST(ItemSets, random) {
+  const size_t nusers = 50;
+  const size_t nitems = 1000;
+  std::mt19937 gen(42);
+  std::vector<std::set<size_t>> expected(nusers);
+  std::vector<std::pair<size_t, size_t>> pairs;
+  for (size_t u = 0; u < nusers; ++u) {
+    // sizes span both sorted lists and bitmaps
+    std::uniform_int_distribution<size_t> distr(0, nitems - 1);
+    const size_t n = u * u;
+    for (size_t k = 0; k < n; ++k) {
+      const size_t i = distr(gen);
+      expected[u].insert(i);
+      pairs.emplace_back(u, i);
+    }
+  }
+  std::shuffle(pairs.begin(), pairs.end(), gen);
+  qmf::ItemSets sets(nusers, nitems, pairs);
+  for (size_t u = 0; u < nusers; ++u) {
+    EXPECT_EQ(sets.size(u), expected[u].size());
+    for (size_t i = 0; i < nitems; ++i) {
+      EXPECT_EQ(sets.contains(u, i), expected[u].count(i) > 0);
+    }
+  }
+}
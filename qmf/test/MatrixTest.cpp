@@ -40,6 +40,21 @@ TEST(Matrix, basic) {
   EXPECT_DEATH(qmf::Matrix(0, 0), ".*");
 }
 
+TEST(Matrix, float) {
+  qmf::FloatMatrix x(2, 3);
+  for (size_t i = 0; i < 2; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      x(i, j) = 0.5f * (i + j);
+    }
+  }
+  const qmf::FloatMatrix s = x + x.transpose().transpose();
+  for (size_t i = 0; i < 2; ++i) {
+    for (size_t j = 0; j < 3; ++j) {
+      EXPECT_EQ(s(i, j), static_cast<float>(i + j));
+    }
+  }
+}
+
 TEST(Matrix, operatorPlus) {
   const size_t n = 3;
   qmf::Matrix x(n, n);
@@ -114,3 +129,33 @@ TEST(Matrix, linearSolve) {
     EXPECT_NEAR(b(i), prod, 1e-8);
   }
 }
+
+TEST(Matrix, symmetricEigen) {
+  const size_t n = 20;
+  std::mt19937 gen(123);
+  std::uniform_real_distribution<qmf::Double> distr(-1.0, 1.0);
+  qmf::Matrix A(n, n);
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = i; j < n; ++j) {
+      qmf::Double x = distr(gen);
+      A(i, j) = A(j, i) = x;
+    }
+  }
+
+  qmf::Vector w(n);
+  qmf::Matrix Q(n, n);
+  qmf::symmetricEigen(A, w, Q);
+  for (size_t k = 0; k < n; ++k) {
+    if (k > 0) {
+      EXPECT_LE(w(k - 1), w(k));
+    }
+    // A * q_k = w_k * q_k
+    for (size_t i = 0; i < n; ++i) {
+      qmf::Double prod = 0.0;
+      for (size_t j = 0; j < n; ++j) {
+        prod += A(i, j) * Q(j, k);
+      }
+      EXPECT_NEAR(prod, w(k) * Q(i, k), 1e-8);
+    }
+  }
+}
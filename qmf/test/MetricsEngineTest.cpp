@@ -0,0 +1,44 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <qmf/metrics/MetricsEngine.h>
+
+#include <gtest/gtest.h>
+
+TEST(TestMetricsEngine, addTestAvgMetric) {
+  qmf::MetricsEngine dense;
+  EXPECT_TRUE(dense.addTestAvgMetric("auc"));
+  EXPECT_TRUE(dense.addTestAvgMetric("auc_approx"));
+  EXPECT_TRUE(dense.addTestAvgMetric("mse"));
+  EXPECT_FALSE(dense.addTestAvgMetric("foo"));
+
+  // only the metrics computed from ranks are available
+  qmf::MetricsConfig streamingConfig{};
+  streamingConfig.streaming = true;
+  qmf::MetricsConfig sampledConfig{};
+  sampledConfig.sampledNegatives = 10;
+  for (const auto& config : {streamingConfig, sampledConfig}) {
+    qmf::MetricsEngine metricsEngine(config, /*log=*/false);
+    EXPECT_TRUE(metricsEngine.addTestAvgMetric("auc"));
+    EXPECT_TRUE(metricsEngine.addTestAvgMetric("ap"));
+    EXPECT_TRUE(metricsEngine.addTestAvgMetric("p@5"));
+    EXPECT_TRUE(metricsEngine.addTestAvgMetric("r@5"));
+    EXPECT_FALSE(metricsEngine.addTestAvgMetric("auc_approx"));
+    EXPECT_FALSE(metricsEngine.addTestAvgMetric("mse"));
+    EXPECT_FALSE(metricsEngine.addTestAvgMetric("foo"));
+    EXPECT_EQ(metricsEngine.testAvgMetrics().size(), 4);
+  }
+}
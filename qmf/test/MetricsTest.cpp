@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <utility>
 #include <vector>
 
 #include <qmf/metrics/Metrics.h>
@@ -52,6 +57,74 @@ TEST(TestMetrics, AUC) {
   EXPECT_DOUBLE_EQ(compute(m, {0.0, 1.0, 1.0}, {3.0, 2.0, 0.0}), 0.0);
 }
 
+TEST(TestMetrics, AUCApprox) {
+  qmf::AUCApprox m(/*nbuckets=*/4);
+  // exact when pairs don't share a bucket
+  EXPECT_DOUBLE_EQ(compute(m, {1.0, 0.0}, {3.0, 2.0}), 1.0);
+  EXPECT_DOUBLE_EQ(compute(m, {0.0, 1.0}, {3.0, 2.0}), 0.0);
+  EXPECT_DOUBLE_EQ(compute(m, {1.0, 0.0, 1.0}, {3.0, 2.0, 0.0}), 0.5);
+  // tied pairs count for 1, as in AUC
+  EXPECT_DOUBLE_EQ(compute(m, {1.0, 0.0}, {1.0, 1.0}), 1.0);
+  // other pairs in a same bucket count for 1/2, here buckets {0, 1} and
+  // {2, 3}
+  EXPECT_DOUBLE_EQ(compute(qmf::AUCApprox(/*nbuckets=*/2),
+                           {1.0, 0.0, 0.0, 0.0}, {3.0, 2.0, 1.0, 0.0}),
+                   2.5 / 3);
+
+  // close to the exact AUC with enough buckets
+  std::mt19937 gen(5);
+  std::normal_distribution<qmf::Double> distr;
+  std::vector<qmf::Double> labels;
+  std::vector<qmf::Double> scores;
+  for (size_t i = 0; i < 10000; ++i) {
+    const bool positive = i % 10 == 0;
+    labels.push_back(positive ? 1.0 : 0.0);
+    scores.push_back(distr(gen) + (positive ? 1.0 : 0.0));
+  }
+  EXPECT_NEAR(compute(qmf::AUCApprox(), labels, scores),
+              compute(qmf::AUC(), labels, scores), 1e-3);
+
+  // an outlier doesn't squeeze the other scores into a few buckets
+  scores[1] = 1e9;
+  EXPECT_NEAR(compute(qmf::AUCApprox(), labels, scores),
+              compute(qmf::AUC(), labels, scores), 1e-3);
+  scores[1] = -1e9;
+  EXPECT_NEAR(compute(qmf::AUCApprox(), labels, scores),
+              compute(qmf::AUC(), labels, scores), 1e-3);
+
+  // skewed scores, with a heavy tail
+  std::exponential_distribution<qmf::Double> expDistr(0.1);
+  for (size_t i = 0; i < scores.size(); ++i) {
+    scores[i] = std::exp(expDistr(gen) + (labels[i] > 0.0 ? 1.0 : 0.0));
+  }
+  EXPECT_NEAR(compute(qmf::AUCApprox(), labels, scores),
+              compute(qmf::AUC(), labels, scores), 1e-3);
+
+  // more scores than sampled for the bucket boundaries
+  const size_t nitems = 2 * qmf::AUCApprox::sampleFactor * 1024;
+  std::bernoulli_distribution labelDistr(0.1);
+  labels.clear();
+  for (size_t i = 0; i < nitems; ++i) {
+    labels.push_back(labelDistr(gen) ? 1.0 : 0.0);
+  }
+
+  // heavy ties, with a few distinct scores
+  std::uniform_int_distribution<int> intDistr(0, 4);
+  scores.clear();
+  for (size_t i = 0; i < nitems; ++i) {
+    scores.push_back(intDistr(gen) + labels[i]);
+  }
+  EXPECT_NEAR(compute(qmf::AUCApprox(), labels, scores),
+              compute(qmf::AUC(), labels, scores), 1e-3);
+
+  // periodic scores, where every other item scores much higher
+  for (size_t i = 0; i < nitems; ++i) {
+    scores[i] = distr(gen) + labels[i] + (i % 2 == 0 ? 0.0 : 10.0);
+  }
+  EXPECT_NEAR(compute(qmf::AUCApprox(), labels, scores),
+              compute(qmf::AUC(), labels, scores), 1e-3);
+}
+
 TEST(TestMetrics, Precision) {
   qmf::Precision m(/*k=*/1);
   EXPECT_DOUBLE_EQ(compute(m, {1.0, 0.0}, {3.0, 2.0}), 1.0);
@@ -86,3 +159,107 @@ TEST(TestMetrics, AveragePrecision) {
   EXPECT_DOUBLE_EQ(compute(m, {0.0, 1.0, 0.0}, {3.0, 2.0, 1.0}), 0.5);
   EXPECT_DOUBLE_EQ(compute(m, {0.0, 1.0, 0.0}, {3.0, 1.0, 2.0}), 1.0 / 3);
 }
+
+// positions of the positives when sorting by decreasing (score, label)
+std::vector<size_t> ranksOf(const std::vector<qmf::Double>& labels,
+                            const std::vector<qmf::Double>& scores) {
+  std::vector<std::pair<qmf::Double, bool>> scored;
+  for (size_t i = 0; i < labels.size(); ++i) {
+    scored.emplace_back(scores[i], labels[i] > 0.0);
+  }
+  std::sort(scored.begin(), scored.end(),
+            std::greater<std::pair<qmf::Double, bool>>());
+  std::vector<size_t> ranks;
+  for (size_t i = 0; i < scored.size(); ++i) {
+    if (scored[i].second) {
+      ranks.push_back(i);
+    }
+  }
+  return ranks;
+}
+
+TEST(TestMetrics, computeFromRanks) {
+  const qmf::AUC auc;
+  const qmf::Precision precision(/*k=*/5);
+  const qmf::Recall recall(/*k=*/5);
+  const qmf::AveragePrecision ap;
+  const std::vector<const qmf::Metric*> metrics = {
+    &auc, &precision, &recall, &ap};
+
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> scoreDistr(0, 20);
+  std::bernoulli_distribution labelDistr(0.2);
+  qmf::ParallelExecutor parallel(2);
+  std::vector<std::vector<qmf::Double>> allLabels;
+  std::vector<std::vector<qmf::Double>> allScores;
+  std::vector<std::vector<size_t>> allRanks;
+  for (size_t user = 0; user < 20; ++user) {
+    const size_t nitems = 30;
+    // few distinct scores, to have ties
+    std::vector<qmf::Double> labels(nitems);
+    std::vector<qmf::Double> scores(nitems);
+    for (size_t i = 0; i < nitems; ++i) {
+      labels[i] = labelDistr(gen) ? 1.0 : 0.0;
+      scores[i] = scoreDistr(gen);
+    }
+    labels[user] = 1.0;
+    const auto ranks = ranksOf(labels, scores);
+    EXPECT_EQ(qmf::Metric::rankPositives(labels, scores), ranks);
+    for (const auto* m : metrics) {
+      EXPECT_NEAR(m->computeFromRanks(ranks, nitems),
+                  m->compute(labels, scores), 1e-12);
+    }
+    allLabels.push_back(labels);
+    allScores.push_back(scores);
+    allRanks.push_back(ranks);
+  }
+  for (const auto* m : metrics) {
+    EXPECT_NEAR(m->compute(allRanks, 30, parallel),
+                m->compute(allLabels, allScores, parallel), 1e-12);
+    EXPECT_DOUBLE_EQ(
+      m->compute(allRanks, std::vector<size_t>(allRanks.size(), 30), parallel),
+      m->compute(allRanks, 30, parallel));
+  }
+
+  const qmf::MeanSquaredError mse;
+  EXPECT_DEATH(mse.computeFromRanks({0}, 2), ".*");
+
+  // a bundle gives the same values as each metric, including the ones that
+  // aren't rank based
+  const std::vector<const qmf::Metric*> bundled = {
+    &auc, &mse, &precision, &recall, &ap};
+  const auto vals =
+    qmf::MetricBundle(bundled).compute(allLabels, allScores, parallel);
+  ASSERT_EQ(vals.size(), bundled.size());
+  for (size_t i = 0; i < bundled.size(); ++i) {
+    EXPECT_NEAR(
+      vals[i], bundled[i]->compute(allLabels, allScores, parallel), 1e-12);
+  }
+  EXPECT_TRUE(qmf::MetricBundle({}).compute(allLabels, allScores, parallel)
+                .empty());
+}
+
+TEST(TestMetrics, MetricBundleFewUsers) {
+  // few users with many items, whose items are split across tasks
+  const qmf::AUC auc;
+  const qmf::Precision precision(/*k=*/10);
+  const qmf::AveragePrecision ap;
+  const std::vector<const qmf::Metric*> metrics = {&auc, &precision, &ap};
+  std::mt19937 gen(11);
+  std::uniform_int_distribution<int> scoreDistr(0, 1000);
+  std::bernoulli_distribution labelDistr(0.01);
+  std::vector<std::vector<qmf::Double>> labels(2);
+  std::vector<std::vector<qmf::Double>> scores(2);
+  for (size_t user = 0; user < 2; ++user) {
+    for (size_t i = 0; i < 20000; ++i) {
+      labels[user].push_back(labelDistr(gen) ? 1.0 : 0.0);
+      scores[user].push_back(scoreDistr(gen));
+    }
+  }
+  qmf::ParallelExecutor parallel(4);
+  const auto vals =
+    qmf::MetricBundle(metrics).compute(labels, scores, parallel);
+  for (size_t i = 0; i < metrics.size(); ++i) {
+    EXPECT_NEAR(vals[i], metrics[i]->compute(labels, scores), 1e-12);
+  }
+}
@@ -61,3 +61,31 @@ TEST(ParallelExecutor, mapReduceElems) {
   }, std::plus<int>(), 0);
   EXPECT_EQ(sum, (ntasks - 1) * ntasks * (2 * ntasks - 1) / 6);
 }
+
+TEST(ParallelExecutor, mapReduceElemsRemainder) {
+  const size_t nthreads = 4;
+  qmf::ParallelExecutor parallel(nthreads);
+
+  // sizes that aren't multiples of the number of threads, including fewer
+  // elements than threads
+  for (const size_t nelems : {1, 3, 5, 1003}) {
+    std::vector<int> elems(nelems, 1);
+    const int count = parallel.mapReduce(
+      elems, [](const int elem) { return elem; }, std::plus<int>(), 0);
+    EXPECT_EQ(count, nelems);
+  }
+}
+
+TEST(ParallelExecutor, numSplits) {
+  qmf::ParallelExecutor parallel(4);
+  // enough elements for 4 tasks per thread
+  EXPECT_EQ(parallel.numSplits(16, 100), 1);
+  EXPECT_EQ(parallel.numSplits(1000, 100), 1);
+  // few elements are split, but not beyond their number of blocks
+  EXPECT_EQ(parallel.numSplits(3, 100), 6);
+  EXPECT_EQ(parallel.numSplits(1, 100), 16);
+  EXPECT_EQ(parallel.numSplits(1, 5), 5);
+  EXPECT_EQ(parallel.numSplits(1, 0), 1);
+  EXPECT_EQ(parallel.numSplits(0, 5), 1);
+  EXPECT_EQ(parallel.numSplits(2, 100, /*tasksPerThread=*/1), 2);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <random>
+#include <vector>
+
+#include <qmf/utils/Random.h>
+
+#include <gtest/gtest.h>
+
+TEST(Random, reproducible) {
+  qmf::Xoshiro256 gen1(42, 3);
+  qmf::Xoshiro256 gen2(42, 3);
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(gen1(), gen2());
+  }
+}
+
+TEST(Random, streams) {
+  // different seeds or streams give different sequences
+  std::vector<qmf::Xoshiro256> gens = {qmf::Xoshiro256(42, 0),
+                                       qmf::Xoshiro256(42, 1),
+                                       qmf::Xoshiro256(43, 0),
+                                       qmf::Xoshiro256(43, 1)};
+  std::vector<uint64_t> values;
+  for (auto& gen : gens) {
+    values.push_back(gen());
+  }
+  for (size_t i = 0; i < values.size(); ++i) {
+    for (size_t j = i + 1; j < values.size(); ++j) {
+      EXPECT_NE(values[i], values[j]);
+    }
+  }
+}
+
+TEST(Random, distribution) {
+  qmf::Xoshiro256 gen(7);
+  std::uniform_int_distribution<int> distr(0, 9);
+  std::vector<size_t> counts(10);
+  const size_t n = 100000;
+  for (size_t i = 0; i < n; ++i) {
+    const int x = distr(gen);
+    ASSERT_GE(x, 0);
+    ASSERT_LE(x, 9);
+    ++counts[x];
+  }
+  for (const size_t count : counts) {
+    EXPECT_NEAR(count, n / 10, n / 100);
+  }
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <qmf/Recommender.h>
+
+#include <gtest/gtest.h>
+
+namespace qmf {
+
+namespace {
+
+// top k items of a user by sorting all its scores
+std::vector<size_t> bruteForce(const FactorData& userFactors,
+                               const FactorData& itemFactors,
+                               const ItemSets& seen,
+                               const size_t uidx,
+                               const size_t k) {
+  std::vector<std::pair<Double, size_t>> scored;
+  for (size_t idx = 0; idx < itemFactors.nelems(); ++idx) {
+    if (seen.nusers() > 0 && seen.contains(uidx, idx)) {
+      continue;
+    }
+    Double score = itemFactors.biasAt(idx);
+    for (size_t f = 0; f < userFactors.nfactors(); ++f) {
+      score += userFactors.at(uidx, f) * itemFactors.at(idx, f);
+    }
+    // higher scores first, then lower indexes
+    scored.emplace_back(-score, idx);
+  }
+  std::sort(scored.begin(), scored.end());
+  std::vector<size_t> res;
+  for (size_t i = 0; i < std::min(k, scored.size()); ++i) {
+    res.push_back(scored[i].second);
+  }
+  return res;
+}
+}
+
+TEST(Recommender, recommend) {
+  const size_t nusers = 50;
+  // several item tiles
+  const size_t nitems = 3 * Recommender::tileItems + 10;
+  const size_t nfactors = 5;
+  FactorData userFactors(nusers, nfactors);
+  FactorData itemFactors(nitems, nfactors, /*withBiases=*/true);
+  // small integer factors, to have ties
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> distr(-3, 3);
+  auto setter = [&distr, &gen](auto...) { return distr(gen); };
+  userFactors.setFactors(setter);
+  itemFactors.setFactors(setter);
+  itemFactors.setBiases(setter);
+
+  std::vector<std::pair<size_t, size_t>> pairs;
+  std::uniform_int_distribution<size_t> itemDistr(0, nitems - 1);
+  for (size_t u = 0; u < nusers; ++u) {
+    for (size_t i = 0; i < 100; ++i) {
+      pairs.emplace_back(u, itemDistr(gen));
+    }
+  }
+  const ItemSets seen(nusers, nitems, pairs);
+  const ItemSets noSeen;
+
+  // many users, few users (whose items are split across tasks), and a user
+  // repeated
+  const std::vector<std::vector<size_t>> userLists = {
+    std::vector<size_t>(), {7}, {3, 1, 3}};
+  for (const size_t nthreads : {1, 4}) {
+    ParallelExecutor parallel(nthreads);
+    for (const auto* exclude : {&seen, &noSeen}) {
+      const Recommender recommender(userFactors, itemFactors, *exclude, 20);
+      for (auto users : userLists) {
+        if (users.empty()) {
+          for (size_t u = 0; u < nusers; ++u) {
+            users.push_back(u);
+          }
+        }
+        const auto recommendations = recommender.recommend(users, parallel);
+        ASSERT_EQ(recommendations.size(), users.size());
+        for (size_t i = 0; i < users.size(); ++i) {
+          std::vector<size_t> items;
+          for (const auto& rec : recommendations[i]) {
+            items.push_back(rec.itemIdx);
+          }
+          EXPECT_EQ(items, bruteForce(userFactors, itemFactors, *exclude,
+                                      users[i], 20));
+          EXPECT_TRUE(std::is_sorted(
+            recommendations[i].begin(), recommendations[i].end(),
+            [](const auto& a, const auto& b) { return a.score > b.score; }));
+        }
+      }
+    }
+  }
+}
+
+TEST(Recommender, fewItems) {
+  // fewer items than k, some of which are seen
+  FactorData userFactors(1, 2);
+  FactorData itemFactors(3, 2);
+  userFactors.setFactors([](size_t, size_t f) { return f + 1.0; });
+  itemFactors.setFactors([](size_t i, size_t) { return i; });
+  const ItemSets seen(1, 3, {{0, 1}});
+  const Recommender recommender(userFactors, itemFactors, seen, 5);
+  ParallelExecutor parallel(2);
+  const auto recommendations = recommender.recommend({0}, parallel);
+  ASSERT_EQ(recommendations.size(), 1);
+  ASSERT_EQ(recommendations[0].size(), 2);
+  EXPECT_EQ(recommendations[0][0].itemIdx, 2);
+  EXPECT_DOUBLE_EQ(recommendations[0][0].score, 6.0);
+  EXPECT_EQ(recommendations[0][1].itemIdx, 0);
+  EXPECT_DOUBLE_EQ(recommendations[0][1].score, 0.0);
+}
+}
@@ -32,4 +32,16 @@ TEST(Vector, basic) {
   EXPECT_ANY_THROW(qmf::Vector(-1));
 }
 
+TEST(Vector, operatorPlus) {
+  qmf::Vector v(3);
+  for (size_t i = 0; i < v.size(); ++i) {
+    v(i) = i;
+  }
+  qmf::Vector s = v + v;
+  EXPECT_EQ(s.size(), 3);
+  for (size_t i = 0; i < s.size(); ++i) {
+    EXPECT_DOUBLE_EQ(s(i), 2 * i);
+  }
 
+  EXPECT_DEATH((v + qmf::Vector(4)), ".*");
+}
@@ -174,7 +174,7 @@ TEST(WALSEngine, updateFactorsForOne) {
 
   WALSEngine::SignalGroup signalGroup{0, {{0, 1.0}, {1, 1.0}}};
 
-  const Double loss = WALSEngine::updateFactorsForOne(
+  WALSEngine::updateFactorsForOne(
     X, userIndex, Y, itemIndex, signalGroup, YtY, 1.0, 1.0);
 
   for (size_t i = 0; i < nfactors; ++i) {
@@ -186,21 +186,238 @@ TEST(WALSEngine, updateFactorsForOne) {
       EXPECT_NEAR(X(i, j), 0.0, 1e-8);
     }
   }
+}
+
+TEST(WALSEngine, updateFactorsForHeavyOne) {
+  const size_t nitems = 23;
+  const size_t nfactors = 4;
+
+  std::mt19937 gen(123);
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  Matrix Y(nitems, nfactors);
+  for (size_t i = 0; i < nitems; ++i) {
+    for (size_t j = 0; j < nfactors; ++j) {
+      Y(i, j) = distr(gen);
+    }
+  }
+
+  IdIndex userIndex;
+  userIndex.getOrSetIdx(0);
+  IdIndex itemIndex;
+  WALSEngine::SignalGroup signalGroup{0, {}};
+  for (size_t i = 0; i < nitems; ++i) {
+    itemIndex.getOrSetIdx(static_cast<int64_t>(i));
+    signalGroup.group.push_back({static_cast<int64_t>(i), 1.0 + i % 3});
+  }
+
+  for (size_t nthreads : {1, 2, 3, 8, 32}) {
+    WALSConfig config;
+    config.nfactors = nfactors;
+    WALSEngine engine(config, kNullMetricEngine, nthreads);
+    Matrix YtY = engine.computeXtX(Y);
+
+    Matrix X(1, nfactors);
+    WALSEngine::updateFactorsForOne(
+      X, userIndex, Y, itemIndex, signalGroup, YtY, 2.0, 0.5);
+    Matrix heavyX(1, nfactors);
+    engine.updateFactorsForHeavyOne(
+      heavyX, userIndex, Y, itemIndex, signalGroup, YtY, 2.0, 0.5);
+
+    for (size_t i = 0; i < nfactors; ++i) {
+      EXPECT_NEAR(heavyX(0, i), X(0, i), 1e-8);
+    }
+  }
+}
+
+TEST(WALSEngine, computeLoss) {
+  WALSConfig config{};
+  config.nfactors = 3;
+  config.confidenceWeight = 2.0;
+  WALSEngine engine(config, kNullMetricEngine, 3);
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1, 1.0}, {1, 2, 3.0}, {1, 3}, {2, 1}, {2, 3, 2.0}, {3, 4}};
+  engine.init(dataset);
+
+  std::mt19937 gen(123);
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  auto genUnif = [&distr, &gen](auto...) { return distr(gen); };
+  engine.userFactors_->setFactors(genUnif);
+  engine.itemFactors_->setFactors(genUnif);
 
   Double trueLoss = 0.0;
-  for (size_t i = 0; i < nusers; ++i) {
-    for (size_t j = 0; j < nitems; ++j) {
+  for (size_t u = 0; u < engine.nusers(); ++u) {
+    for (size_t i = 0; i < engine.nitems(); ++i) {
       Double pred = 0.0;
-      for (size_t k = 0; k < nfactors; ++k) {
-        pred += X(i, k) * Y(j, k);
+      for (size_t k = 0; k < config.nfactors; ++k) {
+        pred += engine.userFactors_->at(u, k) * engine.itemFactors_->at(i, k);
       }
-      if (i == 0) { // both items liked for this user
-        trueLoss += 2.0 * (1.0 - pred) * (1.0 - pred);
-      } else {
-        trueLoss += (0.0 - pred) * (0.0 - pred);
+      Double c = 1.0;
+      Double p = 0.0;
+      for (const auto& elem : dataset) {
+        if (engine.userIndex_.idx(elem.userId) == u &&
+            engine.itemIndex_.idx(elem.itemId) == i) {
+          c += config.confidenceWeight * elem.value;
+          p = 1.0;
+        }
+      }
+      trueLoss += c * (p - pred) * (p - pred);
+    }
+  }
+  trueLoss /= engine.nusers() * engine.nitems();
+
+  EXPECT_NEAR(engine.computeLoss(*engine.userFactors_, engine.userIndex_,
+                                 engine.userSignals_, *engine.itemFactors_,
+                                 engine.itemIndex_),
+              trueLoss, 1e-8);
+  EXPECT_NEAR(engine.computeLoss(*engine.itemFactors_, engine.itemIndex_,
+                                 engine.itemSignals_, *engine.userFactors_,
+                                 engine.userIndex_),
+              trueLoss, 1e-8);
+}
+
+TEST(WALSEngine, skipConvergedRows) {
+  WALSConfig config;
+  config.nfactors = 3;
+  config.regularizationLambda = 0.05;
+  config.confidenceWeight = 1.0;
+  config.initDistributionBound = 0.1;
+  config.convergenceTolerance = 1e100;
+  config.maxSkipEpochs = 2;
+  WALSEngine engine(config, kNullMetricEngine, 2);
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1}, {1, 2}, {1, 3}, {2, 1}, {2, 3}, {3, 4}};
+  engine.init(dataset);
+
+  auto iterateUsers = [&engine]() {
+    return engine.iterate(*engine.userFactors_, engine.userIndex_,
+                          engine.userSignals_, engine.userSchedules_,
+                          *engine.itemFactors_, engine.itemIndex_);
+  };
+
+  // user factors start at zero, so the first update never converges
+  EXPECT_EQ(iterateUsers(), 0);
+  // converged, skipped for 1 epoch
+  EXPECT_EQ(iterateUsers(), 0);
+  EXPECT_EQ(iterateUsers(), engine.nusers());
+  // converged again, skipped for 2 epochs (maxSkipEpochs)
+  EXPECT_EQ(iterateUsers(), 0);
+  EXPECT_EQ(iterateUsers(), engine.nusers());
+  EXPECT_EQ(iterateUsers(), engine.nusers());
+  EXPECT_EQ(iterateUsers(), 0);
+  EXPECT_EQ(iterateUsers(), engine.nusers());
+  EXPECT_EQ(iterateUsers(), engine.nusers());
+
+  // rows that keep moving are never skipped
+  WALSEngine::RowSchedule schedule;
+  engine.reschedule(schedule, 1e200);
+  EXPECT_EQ(schedule.skipLeft, 0);
+  EXPECT_EQ(schedule.skipPeriod, 0);
+}
+
+TEST(WALSEngine, sweepRegularization) {
+  WALSConfig config{};
+  config.nfactors = 3;
+  config.confidenceWeight = 2.0;
+  config.sweepLambdas = {0.01, 0.5, 3.0};
+  WALSEngine engine(config, kNullMetricEngine, 2);
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1, 1.0}, {1, 2, 3.0}, {1, 3}, {2, 1}, {2, 3, 2.0}, {3, 4}};
+  engine.init(dataset);
+  std::mt19937 gen(123);
+  std::uniform_real_distribution<Double> distr(-1.0, 1.0);
+  engine.itemFactors_->setFactors([&distr, &gen](auto...) {
+    return distr(gen);
+  });
+
+  engine.sweepRegularization();
+  EXPECT_EQ(engine.sweepUserFactors_.size(), config.sweepLambdas.size());
+
+  const Matrix& Y = engine.itemFactors_->getFactors();
+  const Matrix YtY = engine.computeXtX(Y);
+  for (size_t k = 0; k < config.sweepLambdas.size(); ++k) {
+    Matrix X(engine.nusers(), config.nfactors);
+    for (const auto& signalGroup : engine.userSignals_) {
+      WALSEngine::updateFactorsForOne(X, engine.userIndex_, Y,
+                                      engine.itemIndex_, signalGroup, YtY,
+                                      config.confidenceWeight,
+                                      config.sweepLambdas[k]);
+    }
+    for (size_t u = 0; u < engine.nusers(); ++u) {
+      for (size_t i = 0; i < config.nfactors; ++i) {
+        EXPECT_NEAR(engine.sweepUserFactors_[k]->at(u, i), X(u, i), 1e-8);
       }
     }
   }
-  EXPECT_NEAR(loss, trueLoss, 1e-2);
+}
+
+TEST(WALSEngine, floatFactors) {
+  WALSConfig config{};
+  config.nfactors = 4;
+  config.regularizationLambda = 0.1;
+  config.confidenceWeight = 5.0;
+  config.initDistributionBound = 0.01;
+  WALSEngine engine(config, kNullMetricEngine, 2);
+  FloatWALSEngine floatEngine(config, kNullMetricEngine, 2);
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1, 1.0}, {1, 2, 3.0}, {1, 3}, {2, 1}, {2, 3, 2.0}, {3, 4}, {3, 2}};
+  engine.init(dataset);
+  floatEngine.init(dataset);
+  std::mt19937 gen(123);
+  std::uniform_real_distribution<float> distr(-1.0, 1.0);
+  engine.itemFactors_->setFactors([&distr, &gen](auto...) {
+    return distr(gen);
+  });
+  floatEngine.itemFactors_->setFactors([&engine](auto i, auto j) {
+    return static_cast<float>(engine.itemFactors_->at(i, j));
+  });
+
+  engine.iterate(*engine.userFactors_, engine.userIndex_, engine.userSignals_,
+                 engine.userSchedules_, *engine.itemFactors_,
+                 engine.itemIndex_);
+  floatEngine.iterate(*floatEngine.userFactors_, floatEngine.userIndex_,
+                      floatEngine.userSignals_, floatEngine.userSchedules_,
+                      *floatEngine.itemFactors_, floatEngine.itemIndex_);
+  for (size_t u = 0; u < engine.nusers(); ++u) {
+    for (size_t i = 0; i < config.nfactors; ++i) {
+      EXPECT_NEAR(
+        floatEngine.userFactors_->at(u, i), engine.userFactors_->at(u, i),
+        1e-5);
+    }
+  }
+}
+
+TEST(WALSEngine, asyncEvaluation) {
+  WALSConfig config{};
+  config.nepochs = 3;
+  config.nfactors = 4;
+  config.regularizationLambda = 0.1;
+  config.confidenceWeight = 5.0;
+  config.initDistributionBound = 0.1;
+  MetricsConfig metricsConfig{};
+  metricsConfig.alwaysCompute = true;
+  metricsConfig.async = true;
+  const auto metricsEngine =
+    std::make_unique<MetricsEngine>(metricsConfig, /*log=*/false);
+  metricsEngine->addTestAvgMetric("auc");
+  WALSEngine engine(config, metricsEngine, 2);
+
+  std::vector<DatasetElem> dataset = {
+    {1, 1, 1.0}, {1, 2, 3.0}, {1, 3}, {2, 1}, {2, 3, 2.0}, {3, 4}, {3, 2}};
+  engine.init(dataset);
+  engine.initTest({{1, 4}, {2, 2}, {3, 1}});
+  engine.optimize();
+
+  // the last evaluation completed, on a snapshot of the final factors
+  ASSERT_TRUE(engine.evalUserFactors_ != nullptr);
+  std::vector<std::vector<Double>> testScores = engine.testScores_;
+  ParallelExecutor parallel(1);
+  Engine::computeTestScores(testScores, engine.testUsers_,
+                            *engine.userFactors_, *engine.itemFactors_,
+                            parallel);
+  EXPECT_EQ(engine.testScores_, testScores);
 }
 }
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <qmf/utils/AliasTable.h>
+
+#include <limits>
+#include <numeric>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+AliasTable::AliasTable(const std::vector<Double>& weights)
+  : prob_(weights.size()), alias_(weights.size()) {
+  const size_t n = weights.size();
+  CHECK_GT(n, 0) << "can't sample from an empty distribution";
+  CHECK_LE(n, std::numeric_limits<uint32_t>::max());
+  const Double sum = std::accumulate(weights.begin(), weights.end(), 0.0);
+  CHECK_GT(sum, 0.0) << "weights should have a positive sum";
+
+  // scale the weights to an average of 1, then pair each bucket below 1 with
+  // one above 1 that fills it up
+  std::vector<uint32_t> small;
+  std::vector<uint32_t> large;
+  for (size_t i = 0; i < n; ++i) {
+    CHECK_GE(weights[i], 0.0) << "weights should be non-negative";
+    prob_[i] = weights[i] * n / sum;
+    alias_[i] = i;
+    (prob_[i] < 1.0 ? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    const uint32_t s = small.back();
+    small.pop_back();
+    const uint32_t l = large.back();
+    alias_[s] = l;
+    prob_[l] -= 1.0 - prob_[s];
+    if (prob_[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // the remaining buckets are full, up to rounding errors
+  for (const uint32_t i : large) {
+    prob_[i] = 1.0;
+  }
+  for (const uint32_t i : small) {
+    prob_[i] = 1.0;
+  }
+}
+}
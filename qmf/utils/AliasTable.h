@@ -0,0 +1,52 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <qmf/Types.h>
+
+namespace qmf {
+
+// samples indexes in O(1) from a fixed discrete distribution, using Vose's
+// alias method
+class AliasTable {
+ public:
+  // weights need to be non-negative, with a positive sum
+  explicit AliasTable(const std::vector<Double>& weights);
+
+  template <typename GenT>
+  size_t sample(GenT&& gen) const {
+    std::uniform_int_distribution<size_t> bucketDistr(0, prob_.size() - 1);
+    std::uniform_real_distribution<Double> probDistr(0.0, 1.0);
+    const size_t bucket = bucketDistr(gen);
+    return probDistr(gen) < prob_[bucket] ? bucket : alias_[bucket];
+  }
+
+  size_t size() const {
+    return prob_.size();
+  }
+
+ private:
+  // bucket i returns i with probability prob_[i], alias_[i] otherwise
+  std::vector<Double> prob_;
+  std::vector<uint32_t> alias_;
+};
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <qmf/utils/FastSigmoid.h>
+
+#include <cmath>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+FastSigmoid::FastSigmoid(const Double bound, const size_t resolution)
+  : bound_(bound), scale_(resolution) {
+  CHECK_GT(bound, 0.0);
+  CHECK_GT(resolution, 0);
+  const size_t npoints = static_cast<size_t>(std::ceil(2 * bound * scale_));
+  // one more point than needed, in case (x + bound) * scale rounds up to the
+  // last one
+  table_.resize(npoints + 2);
+  for (size_t k = 0; k < table_.size(); ++k) {
+    const Double x = k / scale_ - bound_;
+    table_[k] = 1.0 / (1.0 + std::exp(-x));
+  }
+}
+}
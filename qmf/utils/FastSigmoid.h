@@ -0,0 +1,53 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <vector>
+
+#include <qmf/Types.h>
+
+namespace qmf {
+
+// approximates the sigmoid 1 / (1 + exp(-x)) by linear interpolation in a
+// table of its values over [-bound, bound], and clamps it to 0 and 1 outside
+// of it. NaNs are passed through, so that they can still be detected
+class FastSigmoid {
+ public:
+  // the table has `resolution` intervals per unit, which gives an absolute
+  // error of about 0.012 / resolution^2
+  explicit FastSigmoid(const Double bound = 16.0, const size_t resolution = 64);
+
+  Double operator()(const Double x) const {
+    if (x >= bound_) {
+      return 1.0;
+    }
+    if (!(x > -bound_)) {
+      return x <= -bound_ ? 0.0 : x;
+    }
+    const Double pos = (x + bound_) * scale_;
+    const size_t k = static_cast<size_t>(pos);
+    const Double t = pos - k;
+    return table_[k] + t * (table_[k + 1] - table_[k]);
+  }
+
+ private:
+  Double bound_;
+  Double scale_;
+  std::vector<Double> table_;
+};
+}
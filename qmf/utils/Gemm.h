@@ -0,0 +1,121 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+#include <qmf/Types.h>
+
+namespace qmf {
+
+namespace detail {
+
+// C[0, MR) x [0, NR) = A[0, MR) * B[0, NR)^t: the MR * NR sums are kept in
+// registers over the whole inner dimension, so that each loaded element of A
+// (resp. B) is used NR (resp. MR) times
+template <size_t MR, size_t NR, typename ScalarT>
+inline void gemmMicroKernel(const size_t k,
+                            const ScalarT* A,
+                            const size_t lda,
+                            const ScalarT* B,
+                            const size_t ldb,
+                            Double* C,
+                            const size_t ldc) {
+  Double acc[MR][NR] = {};
+  for (size_t p = 0; p < k; ++p) {
+    Double a[MR];
+    Double b[NR];
+    for (size_t r = 0; r < MR; ++r) {
+      a[r] = A[r * lda + p];
+    }
+    for (size_t c = 0; c < NR; ++c) {
+      b[c] = B[c * ldb + p];
+    }
+    for (size_t r = 0; r < MR; ++r) {
+      for (size_t c = 0; c < NR; ++c) {
+        acc[r][c] += a[r] * b[c];
+      }
+    }
+  }
+  for (size_t r = 0; r < MR; ++r) {
+    for (size_t c = 0; c < NR; ++c) {
+      C[r * ldc + c] = acc[r][c];
+    }
+  }
+}
+
+// same as gemmMicroKernel for the partial blocks at the edges of C
+template <typename ScalarT>
+inline void gemmEdgeKernel(const size_t mr,
+                           const size_t nr,
+                           const size_t k,
+                           const ScalarT* A,
+                           const size_t lda,
+                           const ScalarT* B,
+                           const size_t ldb,
+                           Double* C,
+                           const size_t ldc) {
+  for (size_t r = 0; r < mr; ++r) {
+    for (size_t c = 0; c < nr; ++c) {
+      Double acc = 0.0;
+      for (size_t p = 0; p < k; ++p) {
+        acc += static_cast<Double>(A[r * lda + p]) * B[c * ldb + p];
+      }
+      C[r * ldc + c] = acc;
+    }
+  }
+}
+}
+
+// computes C = A * B^t, with A a m x k matrix and B a n x k matrix, both
+// row-major like factor rows, and C a m x n row-major matrix (lda, ldb and ldc
+// are the row strides). the products are accumulated in Double. B is visited
+// by tiles of gemmTileRows rows, which stay in cache while all the rows of A
+// are multiplied by them
+template <typename ScalarT>
+void gemm(const size_t m,
+          const size_t n,
+          const size_t k,
+          const ScalarT* A,
+          const size_t lda,
+          const ScalarT* B,
+          const size_t ldb,
+          Double* C,
+          const size_t ldc) {
+  const size_t gemmTileRows = 128;
+  const size_t mr = 4;
+  const size_t nr = 4;
+  for (size_t j0 = 0; j0 < n; j0 += gemmTileRows) {
+    const size_t j1 = std::min(j0 + gemmTileRows, n);
+    for (size_t i = 0; i < m; i += mr) {
+      const size_t rows = std::min(mr, m - i);
+      for (size_t j = j0; j < j1; j += nr) {
+        const size_t cols = std::min(nr, j1 - j);
+        const ScalarT* a = A + i * lda;
+        const ScalarT* b = B + j * ldb;
+        Double* c = C + i * ldc + j;
+        if (rows == mr && cols == nr) {
+          detail::gemmMicroKernel<mr, nr>(k, a, lda, b, ldb, c, ldc);
+        } else {
+          detail::gemmEdgeKernel(rows, cols, k, a, lda, b, ldb, c, ldc);
+        }
+      }
+    }
+  }
+}
+}
@@ -18,6 +18,8 @@
 
 namespace qmf {
 
+const size_t IdIndex::missingIdx;
+
 size_t IdIndex::getOrSetIdx(const int64_t id) {
   const auto pos = idxMap_.find(id);
   if (pos != idxMap_.end()) {
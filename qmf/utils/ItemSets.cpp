@@ -0,0 +1,83 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <qmf/utils/ItemSets.h>
+
+#include <algorithm>
+#include <limits>
+
+#include <glog/logging.h>
+
+namespace qmf {
+
+const size_t ItemSets::noBitmap;
+
+ItemSets::ItemSets(const size_t nusers,
+                   const size_t nitems,
+                   const std::vector<std::pair<size_t, size_t>>& pairs)
+  : offsets_(nusers + 1), bitmapOffsets_(nusers, noBitmap) {
+  CHECK_LE(nitems, std::numeric_limits<uint32_t>::max())
+    << "too many items for 32-bit indexes";
+  // counting sort of the pairs by user
+  for (const auto& p : pairs) {
+    CHECK_LT(p.first, nusers);
+    CHECK_LT(p.second, nitems);
+    ++offsets_[p.first + 1];
+  }
+  for (size_t u = 0; u < nusers; ++u) {
+    offsets_[u + 1] += offsets_[u];
+  }
+  items_.resize(pairs.size());
+  std::vector<size_t> pos(offsets_.begin(), offsets_.end() - 1);
+  for (const auto& p : pairs) {
+    items_[pos[p.first]++] = static_cast<uint32_t>(p.second);
+  }
+
+  // sort and deduplicate each list, compacting items_ in place
+  size_t next = 0;
+  for (size_t u = 0; u < nusers; ++u) {
+    const auto first = items_.begin() + offsets_[u];
+    const auto last = items_.begin() + offsets_[u + 1];
+    std::sort(first, last);
+    const auto uniqueLast = std::unique(first, last);
+    // the destination must come before first for the copy, so lists that
+    // are already in place (no duplicate removed before them) stay as is
+    const auto dest = items_.begin() + next;
+    if (dest != first) {
+      std::copy(first, uniqueLast, dest);
+    }
+    offsets_[u] = next;
+    next += uniqueLast - first;
+  }
+  offsets_[nusers] = next;
+  items_.resize(next);
+  items_.shrink_to_fit();
+
+  // a bitmap is used when it is no bigger than the sorted list
+  const size_t nwords = (nitems + 63) / 64;
+  for (size_t u = 0; u < nusers; ++u) {
+    if (size(u) > 0 && 32 * size(u) >= nitems) {
+      bitmapOffsets_[u] = bitmaps_.size();
+      bitmaps_.resize(bitmaps_.size() + nwords);
+      uint64_t* bitmap = bitmaps_.data() + bitmapOffsets_[u];
+      for (auto it = begin(u); it != end(u); ++it) {
+        bitmap[*it / 64] |= uint64_t(1) << (*it % 64);
+      }
+    }
+  }
+}
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace qmf {
+
+// compact set of items (e.g. the positives) of each user: the sorted 32-bit
+// item indexes of all users are stored contiguously (CSR layout), and users
+// with many items additionally get a bitmap over all items
+class ItemSets {
+ public:
+  ItemSets() = default;
+
+  // builds the sets from (userIdx, itemIdx) pairs, duplicates are ignored
+  ItemSets(const size_t nusers,
+           const size_t nitems,
+           const std::vector<std::pair<size_t, size_t>>& pairs);
+
+  size_t nusers() const {
+    return offsets_.empty() ? 0 : offsets_.size() - 1;
+  }
+
+  // number of items of a user
+  size_t size(const size_t userIdx) const {
+    return offsets_[userIdx + 1] - offsets_[userIdx];
+  }
+
+  // sorted items of a user are in [begin(userIdx), end(userIdx))
+  const uint32_t* begin(const size_t userIdx) const {
+    return items_.data() + offsets_[userIdx];
+  }
+
+  const uint32_t* end(const size_t userIdx) const {
+    return items_.data() + offsets_[userIdx + 1];
+  }
+
+  bool contains(const size_t userIdx, const size_t itemIdx) const {
+    const size_t bitmap = bitmapOffsets_[userIdx];
+    if (bitmap != noBitmap) {
+      return (bitmaps_[bitmap + itemIdx / 64] >> (itemIdx % 64)) & 1;
+    }
+    // branch-free binary search
+    const uint32_t* base = begin(userIdx);
+    size_t n = size(userIdx);
+    if (n == 0) {
+      return false;
+    }
+    while (n > 1) {
+      const size_t half = n / 2;
+      base = (base[half] <= itemIdx) ? base + half : base;
+      n -= half;
+    }
+    return *base == itemIdx;
+  }
+
+ private:
+  static const size_t noBitmap = static_cast<size_t>(-1);
+
+  // offsets_[u] is the position of the first item of user u in items_
+  std::vector<size_t> offsets_;
+  std::vector<uint32_t> items_;
+
+  // offset of the bitmap of each user in bitmaps_ (noBitmap if none)
+  std::vector<size_t> bitmapOffsets_;
+  std::vector<uint64_t> bitmaps_;
+};
+}
@@ -69,10 +69,11 @@ T ParallelExecutor::mapReduce(const std::vector<ElemT>& elems,
   for (size_t threadId = 0; threadId < nthreads; ++threadId) {
     auto task =
       [&elems, threadId, mapper, reducer, neutral, nthreads, nelems]() {
-        const size_t blockSize = nelems / nthreads;
+        // thread i reduces elements [i * nelems, (i + 1) * nelems) / nthreads,
+        // so that the blocks cover all of them
         return std::accumulate(
-          elems.begin() + threadId * blockSize,
-          elems.begin() + std::min((threadId + 1) * blockSize, nelems),
+          elems.begin() + threadId * nelems / nthreads,
+          elems.begin() + (threadId + 1) * nelems / nthreads,
           neutral, [mapper, reducer](T res, const auto& elem) {
             return reducer(res, mapper(elem));
           });
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <numeric>
 
 #include <qmf/utils/ThreadPool.h>
@@ -56,6 +57,19 @@ class ParallelExecutor {
     return threadPool_->nthreads();
   }
 
+  // number of ranges to split the nblocks blocks of each of nelems elements
+  // into, so that there are at least tasksPerThread tasks per thread even
+  // when there are few elements (e.g. items of few test users)
+  size_t numSplits(const size_t nelems,
+                   const size_t nblocks,
+                   const size_t tasksPerThread = 4) const {
+    if (nelems == 0) {
+      return 1;
+    }
+    const size_t wanted = (tasksPerThread * nthreads() + nelems - 1) / nelems;
+    return std::max<size_t>(std::min(wanted, nblocks), 1);
+  }
+
  private:
   std::unique_ptr<ThreadPool> threadPool_;
 };
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2016 Quora, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+namespace qmf {
+
+// xoshiro256** pseudo-random generator (http://prng.di.unimi.it). Its state
+// is only 32 bytes, so that each thread can cheaply own one, and it satisfies
+// the UniformRandomBitGenerator requirements to be used with <random>
+// distributions.
+class Xoshiro256 {
+ public:
+  using result_type = uint64_t;
+
+  // the generators of different streams of the same seed are seeded
+  // independently, so that each thread can use its own stream
+  explicit Xoshiro256(const uint64_t seed = 0, const uint64_t stream = 0) {
+    uint64_t x = seed;
+    x = splitMix64(x) ^ stream;
+    for (auto& s : s_) {
+      s = splitMix64(x);
+    }
+  }
+
+  static constexpr result_type min() {
+    return 0;
+  }
+
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    const uint64_t res = rotl(s_[1] * 5, 7) * 9;
+    const uint64_t t = s_[1] << 17;
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+    return res;
+  }
+
+ private:
+  static uint64_t rotl(const uint64_t x, const int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  // advances x and returns the next output of the splitmix64 generator
+  static uint64_t splitMix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  uint64_t s_[4];
+};
+}
@@ -28,6 +28,18 @@ DEFINE_uint64(nfactors, 30, "dimension of learned factors");
 DEFINE_double(regularization_lambda, 0.05, "regularization param");
 DEFINE_double(confidence_weight, 40, "confidence weight");
 DEFINE_double(init_distribution_bound, 0.01, "init distirbution bound");
+DEFINE_uint64(heavy_row_threshold, 100000, "rows with at least this many "
+                                           "signals are accumulated in "
+                                           "parallel (0 = disabled)");
+DEFINE_uint64(loss_every, 1, "compute the train loss every N epochs (0 = never)");
+DEFINE_double(convergence_tolerance, 0.0, "skip updating rows whose relative "
+                                          "change is below this (0 = never)");
+DEFINE_uint64(max_skip_epochs, 8, "max number of consecutive epochs a "
+                                  "converged row is skipped");
+DEFINE_string(sweep_lambdas, "", "comma-separated list of regularization "
+                                 "lambdas to re-solve the user factors with "
+                                 "after training");
+DEFINE_bool(float_factors, false, "store the factors in single precision");
 
 // settings
 DEFINE_int32(nthreads, 16, "number of threads for parallel execution");
@@ -43,6 +55,15 @@ DEFINE_uint64(num_test_users, 0, "# users to use for computing test avg metrics
 DEFINE_bool(test_always, false, "whether to compute test avg metrics after "
                                 "each epoch (if false, only computes at the "
                                 "end)");
+DEFINE_bool(streaming_eval, false, "compute test avg metrics by scoring items "
+                                  "by blocks, without dense per-user vectors");
+DEFINE_uint64(eval_sampled_negatives, 0, "rank the positives of each test user "
+              "against this many sampled items instead of all items, for "
+              "test avg metrics recorded as test_sampled_avg_* (0 = disabled)");
+DEFINE_bool(async_eval, false, "compute test avg metrics on a snapshot of the "
+                               "factors in the background, during the next epoch");
+DEFINE_uint64(eval_nthreads, 1, "number of threads of the background "
+              "evaluation with --async_eval, in addition to --nthreads");
 
 // model output
 DEFINE_string(user_factors, "", "filename of user factors");
@@ -60,14 +81,26 @@ int main(int argc, char** argv) {
       << "warning: missing model output filenames! (use options --{user,item}_factors)";
   }
 
+  std::vector<qmf::Double> sweepLambdas;
+  for (const auto& lambda : qmf::split(FLAGS_sweep_lambdas, ',')) {
+    sweepLambdas.push_back(std::stod(lambda));
+  }
+
   qmf::WALSConfig config{FLAGS_nepochs,
                          FLAGS_nfactors,
                          FLAGS_regularization_lambda,
                          FLAGS_confidence_weight,
-                         FLAGS_init_distribution_bound};
+                         FLAGS_init_distribution_bound,
+                         FLAGS_heavy_row_threshold,
+                         FLAGS_loss_every,
+                         FLAGS_convergence_tolerance,
+                         FLAGS_max_skip_epochs,
+                         sweepLambdas};
 
   qmf::MetricsConfig metricsConfig{
-    FLAGS_num_test_users, FLAGS_test_always, FLAGS_eval_seed};
+    FLAGS_num_test_users, FLAGS_test_always, FLAGS_eval_seed,
+    FLAGS_streaming_eval, FLAGS_eval_sampled_negatives, FLAGS_async_eval,
+    FLAGS_eval_nthreads};
   const auto metricsEngine =
     std::make_unique<qmf::MetricsEngine>(metricsConfig);
 
@@ -75,30 +108,38 @@ int main(int argc, char** argv) {
   const auto metrics = qmf::split(FLAGS_test_avg_metrics, ',');
   if (!metrics.empty()) {
     for (const auto& metric : metrics) {
-      CHECK(metricsEngine->addTestAvgMetric(metric)) << "metric " << metric
-                                                     << " is not available";
+      CHECK(metricsEngine->addTestAvgMetric(metric))
+        << "metric " << metric << " is not available (with --streaming_eval "
+        << "or --eval_sampled_negatives, only metrics computed from ranks are)";
     }
   }
 
-  qmf::WALSEngine engine(config, metricsEngine, FLAGS_nthreads);
+  std::unique_ptr<qmf::Engine> engine;
+  if (FLAGS_float_factors) {
+    engine = std::make_unique<qmf::FloatWALSEngine>(
+      config, metricsEngine, FLAGS_nthreads);
+  } else {
+    engine = std::make_unique<qmf::WALSEngine>(
+      config, metricsEngine, FLAGS_nthreads);
+  }
 
   LOG(INFO) << "loading training data";
   qmf::DatasetReader trainReader(FLAGS_train_dataset);
-  engine.init(trainReader.readAll());
+  engine->init(trainReader.readAll());
 
   if (!FLAGS_test_dataset.empty()) {
     LOG(INFO) << "loading test data";
     qmf::DatasetReader testReader(FLAGS_test_dataset);
-    engine.initTest(testReader.readAll());
+    engine->initTest(testReader.readAll());
   }
 
   LOG(INFO) << "training";
-  engine.optimize();
+  engine->optimize();
 
   if (!FLAGS_user_factors.empty() && !FLAGS_item_factors.empty()) {
     LOG(INFO) << "saving model output";
-    engine.saveUserFactors(FLAGS_user_factors);
-    engine.saveItemFactors(FLAGS_item_factors);
+    engine->saveUserFactors(FLAGS_user_factors);
+    engine->saveItemFactors(FLAGS_item_factors);
   }
 
   return 0;
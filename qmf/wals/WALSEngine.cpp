@@ -15,26 +15,33 @@
  */
 
 #include <algorithm>
+#include <cmath>
+#include <functional>
 #include <random>
+#include <sstream>
 
 #include <qmf/wals/WALSEngine.h>
 
 namespace qmf {
 
-WALSEngine::WALSEngine(const WALSConfig& config,
-                       const std::unique_ptr<MetricsEngine>& metricsEngine,
-                       const size_t nthreads)
+template <typename ScalarT>
+BasicWALSEngine<ScalarT>::BasicWALSEngine(
+    const WALSConfig& config,
+    const std::unique_ptr<MetricsEngine>& metricsEngine,
+    const size_t nthreads)
   : config_(config),
     metricsEngine_(metricsEngine),
     parallel_(nthreads) {
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty() &&
-      metricsEngine_->config().numTestUsers == 0) {
+      metricsEngine_->config().numTestUsers == 0 &&
+      metricsEngine_->config().sampledNegatives == 0) {
     LOG(WARNING) << "computing average test metrics on all users can be slow! "
                     "Set numTestUsers > 0 to sample some of them";
   }
 }
 
-void WALSEngine::init(const std::vector<DatasetElem>& dataset) {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::init(const std::vector<DatasetElem>& dataset) {
   CHECK(!userFactors_ && !itemFactors_)
     << "engine was already initialized with train data";
   auto mutableDataset = dataset;
@@ -45,8 +52,10 @@ void WALSEngine::init(const std::vector<DatasetElem>& dataset) {
   }
   groupSignals(itemSignals_, itemIndex_, mutableDataset);
 
-  userFactors_ = std::make_unique<FactorData>(nusers(), config_.nfactors);
-  itemFactors_ = std::make_unique<FactorData>(nitems(), config_.nfactors);
+  userFactors_ = std::make_unique<FactorDataT>(nusers(), config_.nfactors);
+  itemFactors_ = std::make_unique<FactorDataT>(nitems(), config_.nfactors);
+  userSchedules_.resize(nusers());
+  itemSchedules_.resize(nitems());
 
   std::random_device rd;
   std::mt19937 gen(rd());
@@ -57,65 +66,157 @@ void WALSEngine::init(const std::vector<DatasetElem>& dataset) {
   itemFactors_->setFactors(genUnif);
 }
 
-void WALSEngine::initTest(const std::vector<DatasetElem>& testDataset) {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::initTest(
+    const std::vector<DatasetElem>& testDataset) {
   CHECK(testUsers_.empty()) << "engine was already initialized with test data";
 
   // initialize data for test average metrics
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty()) {
-    initAvgTestData(
-      testUsers_, testLabels_, testScores_, testDataset, userIndex_, itemIndex_,
-      metricsEngine_->config().numTestUsers, metricsEngine_->config().seed);
+    if (metricsEngine_->config().sampledNegatives > 0) {
+      initSparseTestData(
+        testUsers_, testPositives_, testDataset, userIndex_, itemIndex_,
+        metricsEngine_->config().numTestUsers, metricsEngine_->config().seed);
+      sampleTestNegatives(testNegatives_, testPositives_, nitems(),
+                          metricsEngine_->config().sampledNegatives,
+                          metricsEngine_->config().seed, parallel_);
+    } else if (metricsEngine_->config().streaming) {
+      initSparseTestData(
+        testUsers_, testPositives_, testDataset, userIndex_, itemIndex_,
+        metricsEngine_->config().numTestUsers, metricsEngine_->config().seed);
+    } else {
+      initAvgTestData(
+        testUsers_, testLabels_, testScores_, testDataset, userIndex_,
+        itemIndex_, metricsEngine_->config().numTestUsers,
+        metricsEngine_->config().seed);
+    }
   }
 }
 
-void WALSEngine::optimize() {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::optimize() {
   CHECK(userFactors_ && itemFactors_)
     << "no factor data, have you initialized the engine?";
 
   for (size_t epoch = 1; epoch <= config_.nepochs; ++epoch) {
     // fix item factors, update user factors
-    iterate(*userFactors_, userIndex_, userSignals_, *itemFactors_, itemIndex_);
+    const size_t userSkipped = iterate(*userFactors_, userIndex_, userSignals_,
+                                       userSchedules_, *itemFactors_,
+                                       itemIndex_);
     // fix user factors, update item factors
-    const Double loss = iterate(*itemFactors_, itemIndex_, itemSignals_, *userFactors_, userIndex_);
-    LOG(INFO) << "epoch " << epoch << ": train loss = " << loss;
+    const size_t itemSkipped = iterate(*itemFactors_, itemIndex_, itemSignals_,
+                                       itemSchedules_, *userFactors_,
+                                       userIndex_);
+    if (config_.convergenceTolerance > 0.0) {
+      LOG(INFO) << "epoch " << epoch << ": skipped " << userSkipped << "/"
+                << nusers() << " users, " << itemSkipped << "/" << nitems()
+                << " items";
+    }
+    if (config_.lossEvery > 0 && epoch % config_.lossEvery == 0) {
+      const Double loss = computeLoss(
+        *itemFactors_, itemIndex_, itemSignals_, *userFactors_, userIndex_);
+      LOG(INFO) << "epoch " << epoch << ": train loss = " << loss;
+    }
     // evaluate
     evaluate(epoch);
   }
+  waitForEvaluation();
+
+  if (!config_.sweepLambdas.empty()) {
+    sweepRegularization();
+  }
 }
 
-void WALSEngine::evaluate(const size_t epoch) {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::evaluate(const size_t epoch) {
   // evaluate test average metrics
   if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty() &&
       !testUsers_.empty() &&
       (metricsEngine_->config().alwaysCompute || epoch == config_.nepochs)) {
+    if (metricsEngine_->config().async) {
+      // the next epoch updates the factors while they're being evaluated, so
+      // the evaluation reads a snapshot of them, once the previous one is done
+      waitForEvaluation();
+      if (!evalUserFactors_) {
+        evalUserFactors_ = std::make_unique<FactorDataT>(*userFactors_);
+        evalItemFactors_ = std::make_unique<FactorDataT>(*itemFactors_);
+      } else {
+        evalUserFactors_->copyFrom(*userFactors_);
+        evalItemFactors_->copyFrom(*itemFactors_);
+      }
+      evaluateAsync(
+        metricsEngine_->config().asyncNthreads,
+        [this, epoch](ParallelExecutor& parallel) {
+          evaluateTestAvgMetrics(
+            epoch, "", *evalUserFactors_, *evalItemFactors_, parallel);
+        });
+    } else {
+      evaluateTestAvgMetrics(
+        epoch, "", *userFactors_, *itemFactors_, parallel_);
+    }
+  }
+}
+
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::evaluateTestAvgMetrics(
+    const size_t epoch,
+    const std::string& tag,
+    const FactorDataT& userFactors,
+    const FactorDataT& itemFactors,
+    ParallelExecutor& parallel) {
+  auto record = [this, epoch, &tag](auto&... args) {
+    if (tag.empty()) {
+      metricsEngine_->computeAndRecordTestAvgMetrics(epoch, args...);
+    } else {
+      metricsEngine_->computeAndRecordTaggedTestAvgMetrics(
+        tag, epoch, args...);
+    }
+  };
+  if (metricsEngine_->config().sampledNegatives > 0) {
+    computeSampledTestRanks(testRanks_, testNitems_, testUsers_,
+                            testPositives_, testNegatives_, userFactors,
+                            itemFactors, parallel);
+    record(testRanks_, testNitems_, parallel);
+  } else if (metricsEngine_->config().streaming) {
+    computeTestRanks(testRanks_, testUsers_, testPositives_, userFactors,
+                     itemFactors, parallel);
+    size_t nitems = itemFactors.nelems();
+    record(testRanks_, nitems, parallel);
+  } else {
     computeTestScores(
-      testScores_, testUsers_, *userFactors_, *itemFactors_, parallel_);
-    metricsEngine_->computeAndRecordTestAvgMetrics(
-      epoch, testLabels_, testScores_, parallel_);
+      testScores_, testUsers_, userFactors, itemFactors, parallel);
+    record(testLabels_, testScores_, parallel);
   }
 }
 
-void WALSEngine::saveUserFactors(const std::string& fileName) const {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::saveUserFactors(
+    const std::string& fileName) const {
   CHECK(userFactors_) << "user factors wasn't initialized";
   saveFactors(*userFactors_, userIndex_, fileName);
 }
 
-void WALSEngine::saveItemFactors(const std::string& fileName) const {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::saveItemFactors(
+    const std::string& fileName) const {
   CHECK(itemFactors_) << "item factors wasn't initialized";
   saveFactors(*itemFactors_, itemIndex_, fileName);
 }
 
-size_t WALSEngine::nusers() const {
+template <typename ScalarT>
+size_t BasicWALSEngine<ScalarT>::nusers() const {
   return userIndex_.size();
 }
 
-size_t WALSEngine::nitems() const {
+template <typename ScalarT>
+size_t BasicWALSEngine<ScalarT>::nitems() const {
   return itemIndex_.size();
 }
 
-void WALSEngine::groupSignals(std::vector<SignalGroup>& signals,
-                              IdIndex& index,
-                              std::vector<DatasetElem>& dataset) {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::groupSignals(std::vector<SignalGroup>& signals,
+                                            IdIndex& index,
+                                            std::vector<DatasetElem>& dataset) {
   sortDataset(dataset);
   const int64_t InvalidId = std::numeric_limits<int64_t>::min();
   int64_t prevId = InvalidId;
@@ -139,7 +240,8 @@ void WALSEngine::groupSignals(std::vector<SignalGroup>& signals,
   }
 }
 
-void WALSEngine::sortDataset(std::vector<DatasetElem>& dataset) {
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::sortDataset(std::vector<DatasetElem>& dataset) {
   std::sort(dataset.begin(), dataset.end(), [](const auto& x, const auto& y) {
     if (x.userId != y.userId) {
       return x.userId < y.userId;
@@ -148,39 +250,221 @@ void WALSEngine::sortDataset(std::vector<DatasetElem>& dataset) {
   });
 }
 
-Double WALSEngine::iterate(FactorData& leftData,
-                           const IdIndex& leftIndex,
-                           const std::vector<SignalGroup>& leftSignals,
-                           const FactorData& rightData,
-                           const IdIndex& rightIndex) {
-  auto genZero = [](auto...) { return 0.0; };
-  leftData.setFactors(genZero);
-
-  Matrix& X = leftData.getFactors();
-  const Matrix& Y = rightData.getFactors();
+template <typename ScalarT>
+size_t BasicWALSEngine<ScalarT>::iterate(
+    FactorDataT& leftData,
+    const IdIndex& leftIndex,
+    const std::vector<SignalGroup>& leftSignals,
+    std::vector<RowSchedule>& leftSchedules,
+    const FactorDataT& rightData,
+    const IdIndex& rightIndex) {
+  MatrixT& X = leftData.getFactors();
+  const MatrixT& Y = rightData.getFactors();
   Matrix YtY = computeXtX(Y);
 
+  // heavy rows would be processed serially by a single worker and end up on
+  // the critical path, so their normal equations are accumulated in parallel
+  std::vector<size_t> rows;
+  std::vector<size_t> heavyRows;
+  for (size_t i = 0; i < leftSignals.size(); ++i) {
+    if (config_.heavyRowThreshold > 0 &&
+        leftSignals[i].group.size() >= config_.heavyRowThreshold) {
+      heavyRows.push_back(i);
+    } else {
+      rows.push_back(i);
+    }
+  }
+
+  // runs `solve` on a row unless it is scheduled to be skipped, and returns
+  // whether it was skipped
+  auto updateRow = [this, &X, &leftIndex, &leftSignals, &leftSchedules](
+    const size_t i, auto&& solve) {
+    if (config_.convergenceTolerance <= 0.0) {
+      solve();
+      return false;
+    }
+    const size_t leftIdx = leftIndex.idx(leftSignals[i].sourceId);
+    auto& schedule = leftSchedules[leftIdx];
+    if (schedule.skipLeft > 0) {
+      --schedule.skipLeft;
+      return true;
+    }
+    Vector prev(X.ncols());
+    for (size_t j = 0; j < X.ncols(); ++j) {
+      prev(j) = X(leftIdx, j);
+    }
+    solve();
+    reschedule(schedule, relativeChange(X, leftIdx, prev));
+    return false;
+  };
+
   auto map = [
     &X,
     &leftIndex,
     &Y,
     &rightIndex,
     &leftSignals,
+    &rows,
+    &updateRow,
     YtY,
     alpha = config_.confidenceWeight,
     lambda = config_.regularizationLambda
   ](const size_t taskId) {
-    return updateFactorsForOne(
-      X, leftIndex, Y, rightIndex, leftSignals[taskId], YtY, alpha, lambda);
+    const auto& signalGroup = leftSignals[rows[taskId]];
+    return static_cast<size_t>(updateRow(rows[taskId], [&]() {
+      updateFactorsForOne(
+        X, leftIndex, Y, rightIndex, signalGroup, YtY, alpha, lambda);
+    }));
   };
 
-  auto reduce = [](Double sum, Double x) { return sum + x; };
+  size_t skipped =
+    parallel_.mapReduce(rows.size(), map, std::plus<size_t>(), size_t(0));
+  for (const size_t i : heavyRows) {
+    skipped += updateRow(i, [&]() {
+      updateFactorsForHeavyOne(X, leftIndex, Y, rightIndex, leftSignals[i],
+                               YtY, config_.confidenceWeight,
+                               config_.regularizationLambda);
+    });
+  }
+  return skipped;
+}
+
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::sweepRegularization() {
+  const auto& lambdas = config_.sweepLambdas;
+  const size_t n = config_.nfactors;
+  sweepUserFactors_.clear();
+  for (size_t k = 0; k < lambdas.size(); ++k) {
+    sweepUserFactors_.push_back(std::make_unique<FactorDataT>(nusers(), n));
+  }
+
+  const MatrixT& Y = itemFactors_->getFactors();
+  Matrix YtY = computeXtX(Y);
+
+  auto map = [this, &lambdas, &Y, &YtY, n](const size_t taskId) {
+    const auto& signalGroup = userSignals_[taskId];
+    NormalEquations eq{YtY, Vector(n)};
+    accumulateSignals(eq, Y, itemIndex_, signalGroup.group.begin(),
+                      signalGroup.group.end(), config_.confidenceWeight);
+    // with A = Q * diag(w) * Q^t, the solution of (A + lambda * I) * x = b
+    // is x = Q * diag(1 / (w + lambda)) * Q^t * b for any lambda
+    Vector w(n);
+    Matrix Q(n, n);
+    symmetricEigen(eq.A, w, Q);
+    Vector c(n);
+    for (size_t i = 0; i < n; ++i) {
+      for (size_t j = 0; j < n; ++j) {
+        c(i) += Q(j, i) * eq.b(j);
+      }
+    }
+    const size_t userIdx = userIndex_.idx(signalGroup.sourceId);
+    for (size_t k = 0; k < lambdas.size(); ++k) {
+      auto& factors = *sweepUserFactors_[k];
+      for (size_t i = 0; i < n; ++i) {
+        Double x = 0.0;
+        for (size_t j = 0; j < n; ++j) {
+          x += Q(i, j) * c(j) / (w(j) + lambdas[k]);
+        }
+        factors.at(userIdx, i) = x;
+      }
+    }
+  };
+  parallel_.execute(userSignals_.size(), map);
+
+  for (size_t k = 0; k < lambdas.size(); ++k) {
+    std::ostringstream tag;
+    tag << "lambda=" << lambdas[k];
+    const Double loss = computeLoss(*sweepUserFactors_[k], userIndex_,
+                                    userSignals_, *itemFactors_, itemIndex_);
+    LOG(INFO) << tag.str() << ": train loss = " << loss;
+    if (metricsEngine_ && !metricsEngine_->testAvgMetrics().empty() &&
+        !testUsers_.empty()) {
+      evaluateTestAvgMetrics(config_.nepochs, tag.str(),
+                             *sweepUserFactors_[k], *itemFactors_, parallel_);
+    }
+  }
+}
+
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::reschedule(
+    RowSchedule& schedule,
+    const Double change) const {
+  if (change < config_.convergenceTolerance) {
+    // each time a row converges again, it is skipped for twice as long
+    schedule.skipPeriod = std::min<uint32_t>(
+      std::max<uint32_t>(1, 2 * schedule.skipPeriod), config_.maxSkipEpochs);
+    schedule.skipLeft = schedule.skipPeriod;
+  } else {
+    schedule.skipPeriod = 0;
+  }
+}
+
+template <typename ScalarT>
+Double BasicWALSEngine<ScalarT>::relativeChange(const MatrixT& X,
+                                                const size_t leftIdx,
+                                                const Vector& prev) {
+  Double diff = 0.0;
+  Double norm = 0.0;
+  for (size_t i = 0; i < prev.size(); ++i) {
+    diff += (X(leftIdx, i) - prev(i)) * (X(leftIdx, i) - prev(i));
+    norm += prev(i) * prev(i);
+  }
+  return std::sqrt(diff / std::max(norm, std::numeric_limits<Double>::min()));
+}
+
+template <typename ScalarT>
+Double BasicWALSEngine<ScalarT>::computeLoss(
+    const FactorDataT& leftData,
+    const IdIndex& leftIndex,
+    const std::vector<SignalGroup>& leftSignals,
+    const FactorDataT& rightData,
+    const IdIndex& rightIndex) {
+  const MatrixT& X = leftData.getFactors();
+  const MatrixT& Y = rightData.getFactors();
+  const size_t n = X.ncols();
+
+  // sum of (x^t * y)^2 over all pairs, as if there were no signals
+  const Matrix XtX = computeXtX(X);
+  const Matrix YtY = computeXtX(Y);
+  Double loss = 0.0;
+  for (size_t i = 0; i < n; ++i) {
+    for (size_t j = 0; j < n; ++j) {
+      loss += XtX(i, j) * YtY(j, i);
+    }
+  }
+
+  // for observed pairs, replace (x^t * y)^2 by c * (1 - x^t * y)^2
+  auto map = [
+    &X,
+    &leftIndex,
+    &Y,
+    &rightIndex,
+    &leftSignals,
+    n,
+    alpha = config_.confidenceWeight
+  ](const size_t taskId) {
+    const auto& signalGroup = leftSignals[taskId];
+    const size_t leftIdx = leftIndex.idx(signalGroup.sourceId);
+    Double res = 0.0;
+    for (const auto& signal : signalGroup.group) {
+      const size_t rightIdx = rightIndex.idx(signal.id);
+      Double pred = 0.0;
+      for (size_t i = 0; i < n; ++i) {
+        pred += static_cast<Double>(X(leftIdx, i)) * Y(rightIdx, i);
+      }
+      const Double c = 1.0 + alpha * signal.value;
+      res += c * (1.0 - pred) * (1.0 - pred) - pred * pred;
+    }
+    return res;
+  };
 
-  Double loss = parallel_.mapReduce(leftSignals.size(), map, reduce, 0.0);
+  loss += parallel_.mapReduce(
+    leftSignals.size(), map, std::plus<Double>(), 0.0);
   return loss / nusers() / nitems();
 }
 
-Matrix WALSEngine::computeXtX(const Matrix& X) {
+template <typename ScalarT>
+Matrix BasicWALSEngine<ScalarT>::computeXtX(const MatrixT& X) {
   const size_t nrows = X.nrows();
   const size_t ntasks = parallel_.nthreads();
   const size_t taskSize = (nrows + ntasks - 1) / ntasks;
@@ -193,7 +477,7 @@ Matrix WALSEngine::computeXtX(const Matrix& X) {
     for (size_t k = l; k < r; ++k) {
       for (size_t i = 0; i < ncols; ++i) {
         for (size_t j = 0; j < ncols; ++j) {
-          XtX(i, j) += X(k, i) * X(k, j);
+          XtX(i, j) += static_cast<Double>(X(k, i)) * X(k, j);
         }
       }
     }
@@ -208,49 +492,97 @@ Matrix WALSEngine::computeXtX(const Matrix& X) {
   return parallel_.mapReduce(ntasks, map, reduce, O);
 }
 
-Double WALSEngine::updateFactorsForOne(Matrix& X,
-                                       const IdIndex& leftIndex,
-                                       const Matrix& Y,
-                                       const IdIndex& rightIndex,
-                                       const SignalGroup& signalGroup,
-                                       Matrix A,
-                                       const Double alpha,
-                                       const Double lambda) {
-  Double loss = 0.0;
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::updateFactorsForOne(
+    MatrixT& X,
+    const IdIndex& leftIndex,
+    const MatrixT& Y,
+    const IdIndex& rightIndex,
+    const SignalGroup& signalGroup,
+    Matrix A,
+    const Double alpha,
+    const Double lambda) {
+  NormalEquations eq{std::move(A), Vector(X.ncols())};
+  accumulateSignals(eq, Y, rightIndex, signalGroup.group.begin(),
+                    signalGroup.group.end(), alpha);
+  solveForOne(
+    X, leftIndex.idx(signalGroup.sourceId), std::move(eq), lambda);
+}
+
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::updateFactorsForHeavyOne(
+    MatrixT& X,
+    const IdIndex& leftIndex,
+    const MatrixT& Y,
+    const IdIndex& rightIndex,
+    const SignalGroup& signalGroup,
+    const Matrix& YtY,
+    const Double alpha,
+    const Double lambda) {
   const size_t n = X.ncols();
-  Vector b(n);
-  for (const auto& signal : signalGroup.group) {
-    const size_t rightIdx = rightIndex.idx(signal.id);
+  const auto& group = signalGroup.group;
+  const size_t ntasks = parallel_.nthreads();
+  const size_t taskSize = (group.size() + ntasks - 1) / ntasks;
+
+  auto map = [&Y, &rightIndex, &group, n, taskSize, alpha](
+    const size_t taskId) {
+    NormalEquations eq{Matrix(n, n), Vector(n)};
+    const size_t l = std::min(group.size(), taskId * taskSize);
+    const size_t r = std::min(group.size(), (taskId + 1) * taskSize);
+    accumulateSignals(
+      eq, Y, rightIndex, group.begin() + l, group.begin() + r, alpha);
+    return eq;
+  };
+
+  auto reduce = [](const NormalEquations& S, const NormalEquations& eq) {
+    return NormalEquations{S.A + eq.A, S.b + eq.b};
+  };
+
+  // the neutral element is used once per thread, so Y^t * Y is added after
+  NormalEquations O{Matrix(n, n), Vector(n)};
+  NormalEquations eq = parallel_.mapReduce(ntasks, map, reduce, O);
+  eq.A = eq.A + YtY;
+  solveForOne(
+    X, leftIndex.idx(signalGroup.sourceId), std::move(eq), lambda);
+}
+
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::accumulateSignals(
+    NormalEquations& eq,
+    const MatrixT& Y,
+    const IdIndex& rightIndex,
+    SignalIterator begin,
+    SignalIterator end,
+    const Double alpha) {
+  const size_t n = Y.ncols();
+  for (auto it = begin; it != end; ++it) {
+    const size_t rightIdx = rightIndex.idx(it->id);
     for (size_t i = 0; i < n; ++i) {
-      b(i) += Y(rightIdx, i) * (1.0 + alpha * signal.value);
+      eq.b(i) += Y(rightIdx, i) * (1.0 + alpha * it->value);
       for (size_t j = 0; j < n; ++j) {
-        A(i, j) += Y(rightIdx, i) * alpha * signal.value * Y(rightIdx, j);
+        eq.A(i, j) += Y(rightIdx, i) * alpha * it->value * Y(rightIdx, j);
       }
     }
-    // for term p^t * C * p
-    loss += 1.0 + alpha * signal.value;
   }
-  // B = Y^t * C * Y
-  Matrix B = A;
+}
+
+template <typename ScalarT>
+void BasicWALSEngine<ScalarT>::solveForOne(MatrixT& X,
+                                           const size_t leftIdx,
+                                           NormalEquations eq,
+                                           const Double lambda) {
+  const size_t n = X.ncols();
+  Matrix& A = eq.A;
   for (size_t i = 0; i < n; ++i) {
     A(i, i) += lambda;
   }
   // A * x = b
-  Vector x = linearSymmetricSolve(A, b);
-  // x^t * Y^t * C * Y * x
-  for (size_t i = 0; i < n; ++i) {
-    for (size_t j = 0; j < n; ++j) {
-      loss += B(i, j) * x(i) * x(j);
-    }
-  }
-  // -2 * x^t * Y^t * C * p
-  for (size_t i = 0; i < n; ++i) {
-    loss -= 2 * x(i) * b(i);
-  }
-  const size_t leftIdx = leftIndex.idx(signalGroup.sourceId);
+  Vector x = linearSymmetricSolve(A, eq.b);
   for (size_t i = 0; i < n; ++i) {
     X(leftIdx, i) = x(i);
   }
-  return loss;
 }
+
+template class BasicWALSEngine<Double>;
+template class BasicWALSEngine<float>;
 }
@@ -38,15 +38,34 @@ struct WALSConfig {
   Double regularizationLambda;
   Double confidenceWeight;
   Double initDistributionBound;
+  // rows with at least this many signals get their normal equations
+  // accumulated in parallel (0 = disabled)
+  size_t heavyRowThreshold = 100000;
+  // compute the train loss every lossEvery epochs (0 = never)
+  size_t lossEvery = 1;
+  // skip the update of rows whose relative change is below this tolerance
+  // (0 = disabled), for 1, 2, 4, ... epochs up to maxSkipEpochs
+  Double convergenceTolerance = 0.0;
+  size_t maxSkipEpochs = 8;
+  // after training, re-solve the user factors for each of these lambdas and
+  // report their loss and test metrics
+  std::vector<Double> sweepLambdas;
 };
 
-class WALSEngine : public Engine {
+// WALS engine, with user and item factors stored as ScalarT (the normal
+// equations of each row are always accumulated and solved in Double)
+template <typename ScalarT>
+class BasicWALSEngine : public Engine {
  public:
-  explicit WALSEngine(
+  explicit BasicWALSEngine(
     const WALSConfig& config,
     const std::unique_ptr<MetricsEngine>& metricsEngine,
     const size_t nthreads = 16);
 
+  ~BasicWALSEngine() override {
+    waitForEvaluation();
+  }
+
   void init(const std::vector<DatasetElem>& dataset) override;
 
   void initTest(const std::vector<DatasetElem>& testDataset) override;
@@ -64,41 +83,114 @@ class WALSEngine : public Engine {
   void saveItemFactors(const std::string& fileName) const override;
 
  private:
+  using FactorDataT = BasicFactorData<ScalarT>;
+  using MatrixT = BasicMatrix<ScalarT>;
+
   struct Signal {
     int64_t id;
     Double value;
   };
+  using SignalIterator = typename std::vector<Signal>::const_iterator;
 
   struct SignalGroup {
     int64_t sourceId;
     std::vector<Signal> group;
   };
 
+  // for skipping the update of rows that have converged
+  struct RowSchedule {
+    uint32_t skipPeriod = 0; // epochs skipped after the last convergence
+    uint32_t skipLeft = 0; // epochs left to skip
+  };
+
+  // (partial) normal equations of one row, A * x = b
+  struct NormalEquations {
+    Matrix A;
+    Vector b;
+  };
+
   static void groupSignals(std::vector<SignalGroup>& signals,
                            IdIndex& index,
                            std::vector<DatasetElem>& dataset);
 
   static void sortDataset(std::vector<DatasetElem>& dataset);
 
-  Double iterate(FactorData& leftData,
+  // returns the number of rows whose update was skipped
+  size_t iterate(FactorDataT& leftData,
                  const IdIndex& leftIndex,
                  const std::vector<SignalGroup>& leftSignals,
-                 const FactorData& rightData,
+                 std::vector<RowSchedule>& leftSchedules,
+                 const FactorDataT& rightData,
                  const IdIndex& rightIndex);
 
-  Matrix computeXtX(const Matrix& X);
+  // computes and records the test average metrics of the given factors, with
+  // tag appended to the metric keys if it isn't empty
+  void evaluateTestAvgMetrics(const size_t epoch,
+                              const std::string& tag,
+                              const FactorDataT& userFactors,
+                              const FactorDataT& itemFactors,
+                              ParallelExecutor& parallel);
+
+  // solves the user factors for every lambda in config_.sweepLambdas, using a
+  // single eigendecomposition of Y^t * C * Y per user
+  void sweepRegularization();
+
+  // reschedules a row given its relative change in the last update
+  void reschedule(RowSchedule& schedule, const Double change) const;
+
+  // computes ||x - prev|| / ||prev||, with x the row leftIdx of X
+  static Double relativeChange(const MatrixT& X,
+                               const size_t leftIdx,
+                               const Vector& prev);
+
+  // computes the (unregularized) train loss, using
+  // sum_{u,i} (x_u^t * y_i)^2 = tr(X^t * X * Y^t * Y) for the unobserved
+  // pairs, so that only the observed ones need to be visited
+  Double computeLoss(const FactorDataT& leftData,
+                     const IdIndex& leftIndex,
+                     const std::vector<SignalGroup>& leftSignals,
+                     const FactorDataT& rightData,
+                     const IdIndex& rightIndex);
+
+  Matrix computeXtX(const MatrixT& X);
 
   /*
-   *
+   * solves the least squares problem of one row of X, given the fixed
+   * factors Y and A = Y^t * Y
    */
-  static Double updateFactorsForOne(Matrix& X,
-                                    const IdIndex& leftIndex,
-                                    const Matrix& Y,
-                                    const IdIndex& rightIndex,
-                                    const SignalGroup& signalGroup,
-                                    Matrix A,
-                                    const Double alpha,
-                                    const Double lambda);
+  static void updateFactorsForOne(MatrixT& X,
+                                  const IdIndex& leftIndex,
+                                  const MatrixT& Y,
+                                  const IdIndex& rightIndex,
+                                  const SignalGroup& signalGroup,
+                                  Matrix A,
+                                  const Double alpha,
+                                  const Double lambda);
+
+  // same as updateFactorsForOne, but splits the accumulation of the normal
+  // equations across threads (for rows with a huge number of signals)
+  void updateFactorsForHeavyOne(MatrixT& X,
+                                const IdIndex& leftIndex,
+                                const MatrixT& Y,
+                                const IdIndex& rightIndex,
+                                const SignalGroup& signalGroup,
+                                const Matrix& YtY,
+                                const Double alpha,
+                                const Double lambda);
+
+  // adds the terms of signals in [begin, end) to the normal equations
+  static void accumulateSignals(NormalEquations& eq,
+                                const MatrixT& Y,
+                                const IdIndex& rightIndex,
+                                SignalIterator begin,
+                                SignalIterator end,
+                                const Double alpha);
+
+  // solves (A + lambda * I) * x = b and stores x in X
+  static void solveForOne(MatrixT& X,
+                          const size_t leftIdx,
+                          NormalEquations eq,
+                          const Double lambda);
 
   const WALSConfig& config_;
 
@@ -111,22 +203,51 @@ class WALSEngine : public Engine {
   IdIndex itemIndex_;
 
   // factors
-  std::unique_ptr<FactorData> userFactors_;
-  std::unique_ptr<FactorData> itemFactors_;
+  std::unique_ptr<FactorDataT> userFactors_;
+  std::unique_ptr<FactorDataT> itemFactors_;
 
   // signals
   std::vector<SignalGroup> userSignals_;
   std::vector<SignalGroup> itemSignals_;
 
+  // snapshot of the factors, for the asynchronous evaluation
+  std::unique_ptr<FactorDataT> evalUserFactors_;
+  std::unique_ptr<FactorDataT> evalItemFactors_;
+
+  // user factors for each lambda of the regularization sweep
+  std::vector<std::unique_ptr<FactorDataT>> sweepUserFactors_;
+
+  // update schedules, when skipping converged rows
+  std::vector<RowSchedule> userSchedules_;
+  std::vector<RowSchedule> itemSchedules_;
+
   // test data
   std::vector<size_t> testUsers_; // indexes of test users
   std::vector<std::vector<Double>> testLabels_;
   std::vector<std::vector<Double>> testScores_;
+  // for the streaming evaluation
+  std::vector<std::vector<size_t>> testPositives_;
+  std::vector<std::vector<size_t>> testRanks_;
+  // for the sampled evaluation
+  std::vector<std::vector<size_t>> testNegatives_;
+  std::vector<size_t> testNitems_;
 
   // for unit tests
   FRIEND_TEST(WALSEngine, init);
   FRIEND_TEST(WALSEngine, initTest);
   FRIEND_TEST(WALSEngine, computeXtX);
   FRIEND_TEST(WALSEngine, updateFactorsForOne);
+  FRIEND_TEST(WALSEngine, updateFactorsForHeavyOne);
+  FRIEND_TEST(WALSEngine, computeLoss);
+  FRIEND_TEST(WALSEngine, skipConvergedRows);
+  FRIEND_TEST(WALSEngine, sweepRegularization);
+  FRIEND_TEST(WALSEngine, floatFactors);
+  FRIEND_TEST(WALSEngine, asyncEvaluation);
 };
+
+using WALSEngine = BasicWALSEngine<Double>;
+
+// keeps factors in single precision, which halves the memory (bandwidth)
+// needed for them
+using FloatWALSEngine = BasicWALSEngine<float>;
 }